@@ -0,0 +1,111 @@
+#include "board_tracker.hpp"
+#include "logger.hpp"
+#include <algorithm>
+#include <cmath>
+
+/**
+ * Number of corners to track.
+ */
+const int MAX_POINTS = 200;
+
+/**
+ * Board is lost if fewer points than this agree on its position.
+ */
+const int MIN_INLIERS = 20;
+
+/**
+ * Point further than this many pixels from where homography puts it is an
+ * outlier, for example a corner hidden by a moved piece.
+ */
+const double RANSAC_THRESHOLD = 2.0;
+
+/**
+ * Board corner shift in pixels which is worth updating the transform.
+ */
+const double MIN_SHIFT = 1.0;
+
+BoardTracker::BoardTracker(cv::Size frame_size) : frame_size(frame_size) {
+}
+
+void BoardTracker::scale(const cv::Mat& gray, cv::Mat& scaled) {
+  if (gray.size() == frame_size) {
+    gray.copyTo(scaled);
+  } else {
+    cv::resize(gray, scaled, frame_size, 0, 0, cv::INTER_LINEAR);
+  }
+}
+
+void BoardTracker::reset(const cv::Mat& gray, const cv::Mat& perspective_transform) {
+  scale(gray, reference);
+  perspective_transform.copyTo(transform);
+  // Board side in top down view is the frame height
+  float side = frame_size.height;
+  std::vector<cv::Point2f> top_down({{0, 0}, {side, 0}, {side, side}, {0, side}});
+  cv::perspectiveTransform(top_down, board_corners, transform.inv());
+  applied_corners = board_corners;
+  cv::Mat mask = cv::Mat::zeros(frame_size, CV_8UC1);
+  std::vector<cv::Point> polygon(board_corners.begin(), board_corners.end());
+  cv::fillConvexPoly(mask, polygon, 255);
+  cv::goodFeaturesToTrack(reference, reference_points, MAX_POINTS, 0.01, 10, mask);
+  board_found = true;
+}
+
+std::optional<cv::Mat> BoardTracker::track(const cv::Mat& gray) {
+  if (reference_points.size() < MIN_INLIERS) {
+    return std::nullopt;
+  }
+  scale(gray, current);
+  std::vector<cv::Point2f> points;
+  std::vector<uchar> status;
+  std::vector<float> errors;
+  cv::calcOpticalFlowPyrLK(reference, current, reference_points, points, status, errors,
+    {21, 21}, 3);
+  std::vector<cv::Point2f> from;
+  std::vector<cv::Point2f> to;
+  for (int i = 0; i < points.size(); i++) {
+    if (status[i]) {
+      from.push_back(reference_points[i]);
+      to.push_back(points[i]);
+    }
+  }
+  if (from.size() < MIN_INLIERS) {
+    if (board_found) {
+      logger::warn("Lost track of the board, only %d of %d points followed",
+        (int)from.size(), (int)reference_points.size());
+    }
+    board_found = false;
+    return std::nullopt;
+  }
+  std::vector<uchar> inliers;
+  cv::Mat homography = cv::findHomography(from, to, cv::RANSAC, RANSAC_THRESHOLD, inliers);
+  int inlier_count = std::count(inliers.begin(), inliers.end(), 1);
+  if (homography.empty() || inlier_count < MIN_INLIERS) {
+    if (board_found) {
+      logger::warn("Lost track of the board, only %d of %d points agree",
+        inlier_count, (int)reference_points.size());
+    }
+    board_found = false;
+    return std::nullopt;
+  }
+  board_found = true;
+  std::vector<cv::Point2f> corners;
+  cv::perspectiveTransform(board_corners, corners, homography);
+  // Homography is relative to the reference frame so errors don't
+  // accumulate, but the change is measured from the transform in use
+  double shift = 0;
+  for (int i = 0; i < corners.size(); i++) {
+    shift = std::max(shift, cv::norm(corners[i] - applied_corners[i]));
+  }
+  if (shift < MIN_SHIFT) {
+    return std::nullopt;
+  }
+  applied_corners = corners;
+  logger::info("Board moved by %.1f pixels, %d of %d points agree",
+    shift, inlier_count, (int)reference_points.size());
+  cv::Mat updated = transform * homography.inv();
+  return updated;
+}
+
+bool BoardTracker::found() const {
+  return board_found;
+}
@@ -0,0 +1,54 @@
+#ifndef BOARD_TRACKER_H_
+#define BOARD_TRACKER_H_
+
+#include <optional>
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+/**
+ * Follows the board when camera or board is bumped. Corners of squares
+ * found in a reference frame are tracked with optical flow into the current
+ * frame and homography between them is fitted with RANSAC, so pieces moved
+ * in between don't disturb it.
+ */
+class BoardTracker {
+ public:
+  /**
+   * All frames are scaled to given size, transforms are relative to it.
+   */
+  BoardTracker(cv::Size frame_size);
+
+  /**
+   * Use given grayscale camera frame where board is found with given
+   * perspective transform as reference.
+   */
+  void reset(const cv::Mat& gray, const cv::Mat& perspective_transform);
+
+  /**
+   * Find the board in given grayscale camera frame. Returns new perspective
+   * transform if board moved noticeably since the last returned transform.
+   */
+  std::optional<cv::Mat> track(const cv::Mat& gray);
+
+  /**
+   * False if board couldn't be found in the last tracked frame.
+   */
+  bool found() const;
+
+ private:
+  cv::Size frame_size;
+  cv::Mat reference;
+  cv::Mat transform;
+  std::vector<cv::Point2f> board_corners;
+  /**
+   * Board corners in the camera frame with the transform in use.
+   */
+  std::vector<cv::Point2f> applied_corners;
+  std::vector<cv::Point2f> reference_points;
+  cv::Mat current;
+  bool board_found = true;
+
+  void scale(const cv::Mat& gray, cv::Mat& scaled);
+};
+
+#endif  // BOARD_TRACKER_H_
@@ -0,0 +1,87 @@
+#include "calibration.hpp"
+#include "logger.hpp"
+#include <filesystem>
+#include <vector>
+
+/**
+ * Side of downsampled board images compared by calibration_match.
+ */
+const int MATCH_SIZE = 120;
+
+static std::string board_file(const std::string& directory) {
+  return directory + "/board.yml";
+}
+
+static std::string reference_file(const std::string& directory) {
+  return directory + "/reference.png";
+}
+
+bool save_calibration(const std::string& directory, const Board& board) {
+  std::error_code error;
+  std::filesystem::create_directories(directory, error);
+  if (error) {
+    logger::error("Failed to create %s: %s", directory.c_str(), error.message().c_str());
+    return false;
+  }
+  // Corners of all squares in camera frame, for inspection by people and
+  // other tools
+  int size = board.reference.rows;
+  std::vector<cv::Point2f> grid;
+  for (int y = 0; y <= 8; y++) {
+    for (int x = 0; x <= 8; x++) {
+      grid.push_back({x * size / 8.0f, y * size / 8.0f});
+    }
+  }
+  cv::perspectiveTransform(grid, grid, board.perspective_transform.inv());
+  cv::FileStorage storage(board_file(directory), cv::FileStorage::WRITE);
+  if (!storage.isOpened()) {
+    logger::error("Failed to write %s", board_file(directory).c_str());
+    return false;
+  }
+  storage << "frame_width" << board.gray.cols;
+  storage << "frame_height" << board.gray.rows;
+  storage << "perspective_transform" << board.perspective_transform;
+  storage << "grid" << grid;
+  storage.release();
+  if (!cv::imwrite(reference_file(directory), board.reference)) {
+    logger::error("Failed to write %s", reference_file(directory).c_str());
+    return false;
+  }
+  return true;
+}
+
+std::shared_ptr<Board> load_calibration(const std::string& directory, cv::Size frame_size) {
+  if (!std::filesystem::exists(board_file(directory))) {
+    return nullptr;
+  }
+  std::shared_ptr<Board> board = std::make_shared<Board>();
+  try {
+    cv::FileStorage storage(board_file(directory), cv::FileStorage::READ);
+    if ((int)storage["frame_width"] != frame_size.width ||
+        (int)storage["frame_height"] != frame_size.height) {
+      logger::info("Saved board calibration is for different frame size");
+      return nullptr;
+    }
+    storage["perspective_transform"] >> board->perspective_transform;
+  } catch (const cv::Exception& e) {
+    logger::error("Failed to read %s: %s", board_file(directory).c_str(), e.what());
+    return nullptr;
+  }
+  board->reference = cv::imread(reference_file(directory), cv::IMREAD_GRAYSCALE);
+  if (board->perspective_transform.size() != cv::Size(3, 3) || board->reference.empty()) {
+    logger::error("Saved board calibration in %s is incomplete", directory.c_str());
+    return nullptr;
+  }
+  return board;
+}
+
+double calibration_match(const Board& board, const cv::Mat& gray) {
+  cv::Mat warped;
+  cv::warpPerspective(gray, warped, board.perspective_transform, board.reference.size());
+  cv::Mat live, reference;
+  cv::resize(warped, live, {MATCH_SIZE, MATCH_SIZE}, 0, 0, cv::INTER_AREA);
+  cv::resize(board.reference, reference, {MATCH_SIZE, MATCH_SIZE}, 0, 0, cv::INTER_AREA);
+  cv::Mat result;
+  cv::matchTemplate(live, reference, result, cv::TM_CCOEFF_NORMED);
+  return result.at<float>(0, 0);
+}
@@ -0,0 +1,29 @@
+#ifndef CALIBRATION_H_
+#define CALIBRATION_H_
+
+#include "video_capture.hpp"
+#include <memory>
+#include <opencv2/opencv.hpp>
+#include <string>
+
+/**
+ * Write board found by detect_board into given directory so it can be
+ * reused after restart. Returns false if it could not be written.
+ */
+bool save_calibration(const std::string& directory, const Board& board);
+
+/**
+ * Read board written by save_calibration. Returns nullptr if there is none
+ * or it was found in frames of different size. Grayscale frame of the
+ * returned board is empty.
+ */
+std::shared_ptr<Board> load_calibration(const std::string& directory, cv::Size frame_size);
+
+/**
+ * Normalised correlation, from -1 to 1, of the board reference with top
+ * down view of grayscale camera frame. Both are downsampled first, so this
+ * is cheap compared to detect_board and tolerates lighting changes.
+ */
+double calibration_match(const Board& board, const cv::Mat& gray);
+
+#endif  // CALIBRATION_H_
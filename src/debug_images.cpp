@@ -0,0 +1,125 @@
+#include "debug_images.hpp"
+#include "logger.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace debug_images {
+
+/**
+ * Maximum number of images waiting to be written.
+ */
+const std::size_t MAX_QUEUED = 16;
+
+class Image {
+ public:
+  std::string file_name;
+  cv::Mat image;
+
+  /**
+   * Instead of writing an image clear directory named file_name.
+   */
+  bool clear = false;
+};
+
+static std::atomic<Level> current_level = Level::Always;
+static std::mutex mutex;
+static std::condition_variable changed;
+static std::deque<Image> queue;
+static bool writing = false;
+static std::once_flag writer_started;
+
+void configure(Level level) {
+  current_level = level;
+}
+
+Level parse_level(std::string_view name) {
+  if (name == "off") {
+    return Level::Off;
+  }
+  if (name == "failure") {
+    return Level::OnFailure;
+  }
+  if (name != "always") {
+    logger::warn("Unknown debug image level %.*s, using always", (int)name.size(), name.data());
+  }
+  return Level::Always;
+}
+
+static void write_images() {
+  for ( ; ; ) {
+    Image next;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      changed.wait(lock, []() { return !queue.empty(); });
+      next = std::move(queue.front());
+      queue.pop_front();
+      writing = true;
+    }
+    if (next.clear) {
+      std::error_code error;
+      std::filesystem::remove_all(next.file_name, error);
+      std::filesystem::create_directories(next.file_name, error);
+      if (error) {
+        logger::warn("Failed to clear %s: %s", next.file_name.c_str(), error.message().c_str());
+      }
+    } else if (!cv::imwrite(next.file_name, next.image)) {
+      logger::warn("Failed to write %s", next.file_name.c_str());
+    }
+    {
+      std::lock_guard<std::mutex> guard(mutex);
+      writing = false;
+    }
+    changed.notify_all();
+  }
+}
+
+static void start_writer() {
+  std::call_once(writer_started, []() {
+    std::thread writer_thread(write_images);
+    writer_thread.detach();
+  });
+}
+
+bool enabled(bool failure) {
+  Level level = current_level;
+  return level == Level::Always || (level == Level::OnFailure && failure);
+}
+
+void write(std::string file_name, const cv::Mat& image, bool failure) {
+  if (!enabled(failure)) {
+    return;
+  }
+  start_writer();
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (queue.size() >= MAX_QUEUED) {
+      logger::debug("Dropping debug image %s", file_name.c_str());
+      return;
+    }
+    // Caller may reuse image buffer, camera buffers are reused too
+    queue.push_back({file_name, image.clone()});
+  }
+  changed.notify_all();
+}
+
+void clear_directory(std::string directory) {
+  start_writer();
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    // Never dropped, images queued afterwards need the directory
+    queue.push_back({directory, cv::Mat(), true});
+  }
+  changed.notify_all();
+}
+
+void flush() {
+  std::unique_lock<std::mutex> lock(mutex);
+  changed.wait(lock, []() { return queue.empty() && !writing; });
+}
+
+}  // namespace debug_images
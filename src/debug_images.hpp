@@ -0,0 +1,55 @@
+#ifndef DEBUG_IMAGES_H_
+#define DEBUG_IMAGES_H_
+
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <string_view>
+
+/**
+ * Debug images written to disk by a background thread so that JPEG encoding
+ * and disk I/O don't slow down frame processing.
+ */
+namespace debug_images {
+  enum class Level {
+    Off,
+    OnFailure,
+    Always
+  };
+
+  /**
+   * Set which images are written. Default is Always.
+   */
+  void configure(Level level);
+
+  /**
+   * Parse level name: off, failure or always.
+   */
+  Level parse_level(std::string_view name);
+
+  /**
+   * True if image with given failure flag would be written, so that
+   * building it can be skipped otherwise.
+   */
+  bool enabled(bool failure = false);
+
+  /**
+   * Queue image to be written to given file. Failure images are written
+   * unless level is Off, others only if level is Always. Image is dropped if
+   * writer is falling behind.
+   */
+  void write(std::string file_name, const cv::Mat& image, bool failure = false);
+
+  /**
+   * Remove everything from given directory, creating it if needed, once
+   * images queued before are written. Images queued afterwards are written
+   * into the empty directory.
+   */
+  void clear_directory(std::string directory);
+
+  /**
+   * Block until all queued images are written.
+   */
+  void flush();
+}
+
+#endif  // DEBUG_IMAGES_H_
@@ -0,0 +1,39 @@
+#include "frame.hpp"
+#include <linux/videodev2.h>
+
+void frame_to_gray(const Frame& frame, cv::Mat& gray) {
+  switch (frame.format) {
+    case V4L2_PIX_FMT_NV12:
+      gray = frame.image.rowRange(0, frame.image.rows * 2 / 3);
+      break;
+    case V4L2_PIX_FMT_YUYV:
+      cv::extractChannel(frame.image, gray, 0);
+      break;
+    case V4L2_PIX_FMT_MJPEG:
+      // Decoding only luma skips chroma upsampling and colour conversion
+      cv::imdecode(frame.image, cv::IMREAD_GRAYSCALE, &gray);
+      break;
+    default:
+      if (frame.image.channels() == 1) {
+        gray = frame.image;
+      } else {
+        cv::cvtColor(frame.image, gray, cv::COLOR_BGR2GRAY);
+      }
+  }
+}
+
+void frame_to_bgr(const Frame& frame, cv::Mat& bgr) {
+  switch (frame.format) {
+    case V4L2_PIX_FMT_NV12:
+      cv::cvtColor(frame.image, bgr, cv::COLOR_YUV2BGR_NV12);
+      break;
+    case V4L2_PIX_FMT_YUYV:
+      cv::cvtColor(frame.image, bgr, cv::COLOR_YUV2BGR_YUY2);
+      break;
+    case V4L2_PIX_FMT_MJPEG:
+      cv::imdecode(frame.image, cv::IMREAD_COLOR, &bgr);
+      break;
+    default:
+      frame.image.copyTo(bgr);
+  }
+}
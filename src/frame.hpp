@@ -0,0 +1,44 @@
+#ifndef FRAME_H_
+#define FRAME_H_
+
+#include <chrono>
+#include <cstdint>
+#include <opencv2/opencv.hpp>
+
+/**
+ * Image grabbed from the camera.
+ */
+class Frame {
+ public:
+  /**
+   * BGR image or, if format is set, raw camera data which may point directly
+   * into camera buffer.
+   */
+  cv::Mat image;
+
+  /**
+   * V4L2 pixel format (fourcc) of raw image or 0 for BGR image.
+   */
+  std::uint32_t format = 0;
+
+  std::chrono::steady_clock::time_point timestamp;
+  std::uint64_t sequence;
+
+  /**
+   * Index of camera buffer holding image or -1 if image owns its data.
+   */
+  int buffer = -1;
+};
+
+/**
+ * Grayscale version of the frame. For YUV formats it is luma plane, no colour
+ * conversion is done and for NV12 no data is copied either.
+ */
+void frame_to_gray(const Frame& frame, cv::Mat& gray);
+
+/**
+ * BGR version of the frame.
+ */
+void frame_to_bgr(const Frame& frame, cv::Mat& bgr);
+
+#endif  // FRAME_H_
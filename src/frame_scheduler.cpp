@@ -0,0 +1,50 @@
+#include "frame_scheduler.hpp"
+#include <algorithm>
+
+using namespace std::chrono_literals;
+
+/**
+ * Time between processed frames while nothing happens on the board.
+ */
+const std::chrono::milliseconds IDLE_INTERVAL = 200ms;
+
+/**
+ * How long to stay at full rate after the last motion.
+ */
+const std::chrono::milliseconds MOTION_WINDOW = 2s;
+
+/**
+ * How long to stay at full rate after a move.
+ */
+const std::chrono::milliseconds MOVE_WINDOW = 5s;
+
+FrameScheduler::FrameScheduler(int width, int height)
+    : width(width), height(height) {
+}
+
+void FrameScheduler::set_playing(bool playing) {
+  std::lock_guard guard(mutex);
+  this->playing = playing;
+  active_until = std::chrono::steady_clock::now() + MOVE_WINDOW;
+}
+
+void FrameScheduler::motion(std::chrono::steady_clock::time_point now) {
+  std::lock_guard guard(mutex);
+  active_until = std::max(active_until, now + MOTION_WINDOW);
+}
+
+void FrameScheduler::move_finished(std::chrono::steady_clock::time_point now) {
+  std::lock_guard guard(mutex);
+  active_until = std::max(active_until, now + MOVE_WINDOW);
+}
+
+FrameScheduler::Mode FrameScheduler::mode(std::chrono::steady_clock::time_point now) {
+  std::lock_guard guard(mutex);
+  if (!playing) {
+    return {width, height, IDLE_INTERVAL};
+  }
+  if (now < active_until) {
+    return {width, height, 0ms};
+  }
+  return {width / 2, height / 2, IDLE_INTERVAL};
+}
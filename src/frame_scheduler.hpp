@@ -0,0 +1,61 @@
+#ifndef FRAME_SCHEDULER_H_
+#define FRAME_SCHEDULER_H_
+
+#include <chrono>
+#include <mutex>
+
+/**
+ * Decides how often and at which resolution camera frames are processed.
+ * Frames are processed at full rate and resolution while someone is moving
+ * pieces and shortly after each move, otherwise rarely and at reduced
+ * resolution.
+ */
+class FrameScheduler {
+ public:
+  /**
+   * Camera settings for the next frames.
+   */
+  class Mode {
+   public:
+    int width;
+    int height;
+
+    /**
+     * Minimum time between processed frames.
+     */
+    std::chrono::milliseconds interval;
+  };
+
+  FrameScheduler(int width, int height);
+
+  /**
+   * Game started or stopped. Frames are needed only to start a game when
+   * there is no game in progress, so they are processed rarely but at full
+   * resolution for board detection.
+   */
+  void set_playing(bool playing);
+
+  /**
+   * Motion was detected on the board at given time.
+   */
+  void motion(std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+  /**
+   * Move was finished at given time, opponent is likely to move soon.
+   */
+  void move_finished(std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+  /**
+   * Camera settings at given time.
+   */
+  Mode mode(std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now());
+
+ private:
+  int width;
+  int height;
+  std::mutex mutex;
+  bool playing = false;
+  std::chrono::steady_clock::time_point active_until;
+};
+
+#endif  // FRAME_SCHEDULER_H_
@@ -1,22 +1,42 @@
 #include "chess_engine.hpp"
 #include "game.hpp"
 #include "logger.hpp"
+#include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <map>
 #include <thread>
 
 using namespace std::chrono_literals;
 
+/**
+ * How many points of move score each unit of occupancy log likelihood is
+ * worth.
+ */
+const double OCCUPANCY_WEIGHT = 0.25;
+
+/**
+ * Longest time between hand leaving the board and move being recognised
+ * which is credited back to the player. Replayed frames can have timestamps
+ * unrelated to the wall clock.
+ */
+const std::chrono::milliseconds MAX_MOVE_DELAY = 5s;
+
 Game::Game(chess::Openings& openings, std::string device, std::string command, Process& piper)
     : openings(openings), text_to_speech(22050, device, piper), uci(command), video_capture(
       [&]() {
         logger::info("Move started");
       },
-      [&](SquareChange changes[64]) {
-        logger::info("Move finished");
-        return consider_move(changes);
+      [&](FinishedMove& finished) {
+        logger::info("Move finished with confidence %.2f", finished.confidence);
+        return consider_move(finished);
+      },
+      [&]() {
+        text_to_speech.say("Chess board not found");
+        on_game_over();
       }
     ) {
+  video_capture.set_calibration_directory("calibration");
   video_capture.start();
 }
 
@@ -47,10 +67,18 @@ void Game::start(unsigned int time_ms, unsigned int increment_ms) {
   video_capture.start_game();
 }
 
-std::optional<chess::Move> Game::most_likely_move(chess::Position& position, SquareChange changes[64]) {
+std::optional<chess::Move> Game::most_likely_move(chess::Position& position, SquareChange changes[64],
+    const OccupancyClassifier* occupancy) {
   std::vector<chess::Move> moves = position.generate_legal_moves();
+  std::vector<double> occupancy_scores;
+  double best_occupancy_score = 0;
+  if (occupancy != nullptr && !moves.empty()) {
+    occupancy_scores = occupancy->score(position, moves);
+    best_occupancy_score = *std::max_element(occupancy_scores.begin(), occupancy_scores.end());
+  }
   std::map<int, chess::Move> candidates;
-  for (auto & move : moves) {
+  for (int m = 0; m < moves.size(); m++) {
+    chess::Move& move = moves[m];
     int from = -1;
     int to = -1;
     int score = 0;
@@ -108,6 +136,9 @@ std::optional<chess::Move> Game::most_likely_move(chess::Position& position, Squ
     } else {
       score -= 5;
     }
+    if (!occupancy_scores.empty()) {
+      score += (int)std::round(OCCUPANCY_WEIGHT * (occupancy_scores[m] - best_occupancy_score));
+    }
     logger::info("Move: %s %d %s", move.to_string().c_str(),
       score, candidate ? " candidate" : "");
     if (candidate) {
@@ -120,7 +151,8 @@ std::optional<chess::Move> Game::most_likely_move(chess::Position& position, Squ
   return std::nullopt;
 }
 
-std::string Game::consider_move(SquareChange changes[64]) {
+std::string Game::consider_move(FinishedMove& finished) {
+  SquareChange* changes = finished.changes;
   logger::info("6 best candidate squares: %s, %s, %s, %s, %s, %s",
     chess::index2string(changes[0].index).c_str(),
     chess::index2string(changes[1].index).c_str(),
@@ -128,7 +160,13 @@ std::string Game::consider_move(SquareChange changes[64]) {
     chess::index2string(changes[3].index).c_str(),
     chess::index2string(changes[4].index).c_str(),
     chess::index2string(changes[5].index).c_str());
-  std::optional<chess::Move> best_new_move = most_likely_move(position, changes);
+  // Board image before the move shows current position
+  bool classified = occupancy.train(finished.before, position);
+  if (classified) {
+    occupancy.classify(finished.after);
+  }
+  std::optional<chess::Move> best_new_move = most_likely_move(position, changes,
+    classified ? &occupancy : nullptr);
   if (best_new_move) {
     chess::GameResult result = position.move(best_new_move.value());
     std::string message = result.message;
@@ -140,7 +178,11 @@ std::string Game::consider_move(SquareChange changes[64]) {
     if (result.winner != chess::Winner::None) {
       playing = false;
     } else {
-      switch_clock();
+      std::chrono::milliseconds delay = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - finished.timestamp);
+      delay = std::clamp(delay, std::chrono::milliseconds(0), MAX_MOVE_DELAY);
+      logger::info("Crediting %d ms of move recognition", (int)delay.count());
+      switch_clock(delay);
     }
     return best_new_move.value().to_string();
   }
@@ -174,12 +216,15 @@ void Game::resume() {
   video_capture.resume_game();
 }
 
-void Game::switch_clock() {
+void Game::switch_clock(std::chrono::milliseconds delay) {
+  unsigned int millis = delay.count();
   if (!position.white_turn) {
-    time_white_ms += increment_ms;
+    time_white_ms += increment_ms + millis;
+    time_black_ms -= std::min(time_black_ms, millis);
     display.set_white(format_time(time_white_ms));
   } else {
-    time_black_ms += increment_ms;
+    time_black_ms += increment_ms + millis;
+    time_white_ms -= std::min(time_white_ms, millis);
     display.set_black(format_time(time_black_ms));
   }
 }
@@ -245,7 +290,7 @@ void Game::shutdown() {
 
 void Game::best_move() {
   std::vector<chess::Move> moves = position.generate_legal_moves();
-  std::vector<chess::EvaluatedMove> scores = uci.evaluate_moves(position, moves);
+  std::vector<chess::EvaluatedMove> scores = uci.evaluate_moves_within(position, moves);
   if (scores.empty()) {
     return;
   }
@@ -257,7 +302,7 @@ void Game::best_move() {
 
 void Game::worst_move() {
   std::vector<chess::Move> moves = position.generate_legal_moves();
-  std::vector<chess::EvaluatedMove> scores = uci.evaluate_moves(position, moves);
+  std::vector<chess::EvaluatedMove> scores = uci.evaluate_moves_within(position, moves);
   if (scores.empty()) {
     return;
   }
@@ -269,7 +314,7 @@ void Game::worst_move() {
 
 void Game::who_is_winning() {
   std::vector<chess::Move> moves = position.generate_legal_moves();
-  std::vector<chess::EvaluatedMove> scores = uci.evaluate_moves(position, moves);
+  std::vector<chess::EvaluatedMove> scores = uci.evaluate_moves_within(position, moves);
   if (scores.empty()) {
     return;
   }
@@ -291,3 +336,7 @@ void Game::who_is_winning() {
     text_to_speech.say(std::string(value > 0 ? "white": "black") + " has winning advantage");
   }
 }
+
+void Game::set_analysis_size(int size) {
+  video_capture.set_analysis_size(size);
+}
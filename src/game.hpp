@@ -3,6 +3,7 @@
 
 #include "chess_engine.hpp"
 #include "display.hpp"
+#include "occupancy.hpp"
 #include "openings.hpp"
 #include "text_to_speech.hpp"
 #include "uci.hpp"
@@ -18,13 +19,14 @@ class Game {
 
   void ready();
   void start(unsigned int time_ms, unsigned int increment_ms);
-  std::string consider_move(SquareChange changes[64]);
+  std::string consider_move(FinishedMove& finished);
   void stop();
   void resume();
   void shutdown();
   void best_move();
   void worst_move();
   void who_is_winning();
+  void set_analysis_size(int size);
 
  private:
   chess::Openings& openings;
@@ -36,14 +38,24 @@ class Game {
   Display display;
   TextToSpeech text_to_speech;
   VideoCapture video_capture;
+  OccupancyClassifier occupancy;
   std::chrono::steady_clock::time_point last_clock_change;
 
   std::string format_time(unsigned int time_ms);
-  void switch_clock();
+  /**
+   * Give increment to the side which just moved. Time the move spent being
+   * recognised is given back to it and taken from the opponent instead.
+   */
+  void switch_clock(std::chrono::milliseconds delay = std::chrono::milliseconds(0));
   void update_clock();
   void stop_blinking();
   void on_game_over();
-  std::optional<chess::Move> most_likely_move(chess::Position& position, SquareChange changes[64]);
+  /**
+   * Rank legal moves by squares which changed the most and, if given, by
+   * how well occupancy of the squares after the move matches the classifier.
+   */
+  std::optional<chess::Move> most_likely_move(chess::Position& position, SquareChange changes[64],
+    const OccupancyClassifier* occupancy = nullptr);
 };
 
 #endif  // GAME_H_
@@ -0,0 +1,52 @@
+#include "line_reader.hpp"
+#include "logger.hpp"
+#include <cstring>
+#include <unistd.h>
+
+LineReader::LineReader(int fd) : fd(fd) {
+}
+
+bool LineReader::read(std::function<void(std::string_view)> callback) {
+  if (end == sizeof(buffer)) {
+    if (start == 0) {
+      // Line doesn't fit into the buffer, drop it up to the next new line
+      logger::warn("Discarding line longer than %d bytes", (int)sizeof(buffer));
+      discarding = true;
+      end = 0;
+    } else {
+      // Move incomplete line to the beginning of the buffer
+      std::memmove(buffer, buffer + start, end - start);
+      end -= start;
+      start = 0;
+    }
+  }
+  ssize_t result = ::read(fd, buffer + end, sizeof(buffer) - end);
+  if (result == -1) {
+    logger::last("Failed to read line");
+    return false;
+  }
+  if (result == 0) {
+    return false;
+  }
+  std::size_t scan = end;
+  end += result;
+  for (std::size_t i = scan; i < end; i++) {
+    if (buffer[i] != '\n') {
+      continue;
+    }
+    if (discarding) {
+      discarding = false;
+    } else {
+      std::size_t line_end = i;
+      if (line_end > start && buffer[line_end - 1] == '\r') {
+        line_end--;
+      }
+      callback(std::string_view(buffer + start, line_end - start));
+    }
+    start = i + 1;
+  }
+  if (start == end) {
+    start = end = 0;
+  }
+  return true;
+}
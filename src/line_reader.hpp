@@ -0,0 +1,30 @@
+#ifndef LINE_READER_H_
+#define LINE_READER_H_
+
+#include <cstddef>
+#include <functional>
+#include <string_view>
+
+/**
+ * Splits output of a file descriptor into lines without allocating memory.
+ */
+class LineReader {
+ public:
+  LineReader(int fd);
+
+  /**
+   * Block until some data is available and call callback for each complete
+   * line. Line is passed without trailing new line characters and is valid
+   * only during the callback. Return false on end of file or error.
+   */
+  bool read(std::function<void(std::string_view)> callback);
+
+ private:
+  int fd;
+  char buffer[8192];
+  std::size_t start = 0;
+  std::size_t end = 0;
+  bool discarding = false;
+};
+
+#endif  // LINE_READER_H_
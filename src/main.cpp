@@ -1,11 +1,13 @@
 #include "audio_capture.hpp"
 #include "command_parser.hpp"
+#include "debug_images.hpp"
 #include "game.hpp"
 #include "logger.hpp"
 #include "openings.hpp"
 #include "process.hpp"
 #include "speech_to_text.hpp"
 
+#include <charconv>
 #include <cstdlib>
 #include <string>
 
@@ -24,6 +26,9 @@ int main(int argc, char** argv) {
   } else {
     uci_engine = "/usr/games/stockfish";
   }
+  if (argc > 4) {
+    debug_images::configure(debug_images::parse_level(argv[4]));
+  }
 
   Process piper_process({
     "piper/piper", "--model", "models/en_US-amy-medium.onnx", "-q", "--output_raw"
@@ -32,6 +37,16 @@ int main(int argc, char** argv) {
   chess::Openings openings("openings");
 
   Game game(openings, audio_output, uci_engine, piper_process);
+  if (argc > 5) {
+    std::string value(argv[5]);
+    int analysis_size;
+    std::from_chars_result result = std::from_chars(value.data(), value.data() + value.size(), analysis_size);
+    if (result.ec == std::errc() && result.ptr == value.data() + value.size()) {
+      game.set_analysis_size(analysis_size);
+    } else {
+      logger::error("Invalid analysis size '%s', using the default", value.c_str());
+    }
+  }
   CommandParser command_parser;
   SpeechToText speech_to_text;
   AudioCapture audio_capture(speech_to_text.getSampleRate(), audio_input);
@@ -0,0 +1,128 @@
+#include "motion_detector.hpp"
+#include <algorithm>
+#include <cmath>
+
+/**
+ * How fast background adapts to slow changes like lighting.
+ */
+const float LEARNING_RATE = 0.01f;
+
+/**
+ * Pixel differs from background if it is further from its mean than this
+ * many standard deviations.
+ */
+const float DEVIATIONS = 3.0f;
+
+/**
+ * Camera noise below this difference of gray levels is never a change.
+ */
+const float MIN_DIFFERENCE = 15.0f;
+
+const float MIN_VARIANCE = MIN_DIFFERENCE * MIN_DIFFERENCE / (DEVIATIONS * DEVIATIONS);
+
+/**
+ * Fraction of changed pixels signaling that a hand entered the board.
+ */
+const double START_CHANGE = 0.05;
+
+/**
+ * Board is still if fewer pixels than this fraction changed since previous
+ * frame.
+ */
+const double STILL_CHANGE = 0.005;
+
+/**
+ * Number of consecutive still frames needed to finish motion.
+ */
+const int STILL_FRAMES = 5;
+
+/**
+ * Number of consecutive still frames after which motion is finished even if
+ * board still differs from background a lot.
+ */
+const int MAX_STILL_FRAMES = 30;
+
+void MotionDetector::reset(const cv::Mat& board) {
+  cv::resize(board, small, {SIZE, SIZE}, 0, 0, cv::INTER_AREA);
+  small.copyTo(previous);
+  small.convertTo(mean, CV_32F);
+  variance.create(SIZE, SIZE, CV_32F);
+  variance.setTo(MIN_VARIANCE);
+  square_activity.fill(0);
+  background_change = peak_change = 0;
+  still_frames = 0;
+  in_motion = false;
+}
+
+Motion MotionDetector::update(const cv::Mat& board) {
+  if (mean.empty()) {
+    reset(board);
+    return Motion::None;
+  }
+  cv::resize(board, small, {SIZE, SIZE}, 0, 0, cv::INTER_AREA);
+  const int block = SIZE / 8;
+  std::array<int, 64> changed{};
+  int total = 0;
+  int moved = 0;
+  for (int y = 0; y < SIZE; y++) {
+    const uchar* pixels = small.ptr<uchar>(y);
+    uchar* previous_pixels = previous.ptr<uchar>(y);
+    float* means = mean.ptr<float>(y);
+    float* variances = variance.ptr<float>(y);
+    for (int x = 0; x < SIZE; x++) {
+      if (std::abs(pixels[x] - previous_pixels[x]) > MIN_DIFFERENCE) {
+        moved++;
+      }
+      previous_pixels[x] = pixels[x];
+      float difference = pixels[x] - means[x];
+      float squared = difference * difference;
+      if (squared > DEVIATIONS * DEVIATIONS * variances[x]) {
+        changed[(y / block) * 8 + x / block]++;
+        total++;
+        // Learn slowly from changes so hands don't become part of background
+        // quickly but sudden lighting changes are eventually accepted
+        means[x] += LEARNING_RATE / 10 * difference;
+      } else {
+        means[x] += LEARNING_RATE * difference;
+        variances[x] = std::max(variances[x] + LEARNING_RATE * (squared - variances[x]), MIN_VARIANCE);
+      }
+    }
+  }
+  for (int i = 0; i < 64; i++) {
+    square_activity[i] = changed[i] / (float)(block * block);
+  }
+  background_change = total / (double)(SIZE * SIZE);
+  still_frames = moved < STILL_CHANGE * SIZE * SIZE ? still_frames + 1 : 0;
+  if (!in_motion) {
+    if (background_change > START_CHANGE) {
+      in_motion = true;
+      peak_change = background_change;
+      return Motion::Started;
+    }
+    return Motion::None;
+  }
+  peak_change = std::max(peak_change, background_change);
+  // Moved pieces stay different from background, but much less than hands
+  if (still_frames >= STILL_FRAMES && background_change < peak_change / 2 ||
+      still_frames >= MAX_STILL_FRAMES) {
+    in_motion = false;
+    return Motion::Finished;
+  }
+  return Motion::None;
+}
+
+double MotionDetector::change() const {
+  return background_change;
+}
+
+const std::array<float, 64>& MotionDetector::activity() const {
+  return square_activity;
+}
+
+bool MotionDetector::moving() const {
+  return in_motion;
+}
+
+int MotionDetector::still() const {
+  return still_frames;
+}
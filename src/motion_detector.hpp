@@ -0,0 +1,83 @@
+#ifndef MOTION_DETECTOR_H_
+#define MOTION_DETECTOR_H_
+
+#include <array>
+#include <opencv2/opencv.hpp>
+
+enum class Motion {
+  /**
+   * Nothing new happened.
+   */
+  None,
+
+  /**
+   * Something (presumably a hand) entered the board.
+   */
+  Started,
+
+  /**
+   * Board became still again.
+   */
+  Finished
+};
+
+/**
+ * Detects hands over the board by comparing a small grayscale image of the
+ * board against running mean and variance of each of its pixels. Each
+ * square of the board is covered by a block of pixels so activity of
+ * individual squares is known too.
+ */
+class MotionDetector {
+ public:
+  /**
+   * Side of the downsampled board image in pixels.
+   */
+  static const int SIZE = 64;
+
+  /**
+   * Forget everything learned and use given grayscale board image as
+   * background.
+   */
+  void reset(const cv::Mat& board);
+
+  /**
+   * Compare grayscale board image with background and previous image and
+   * tell if motion started or finished.
+   */
+  Motion update(const cv::Mat& board);
+
+  /**
+   * Fraction of pixels which differ from background in the last image.
+   */
+  double change() const;
+
+  /**
+   * Fraction of pixels of each square which differ from background in the
+   * last image. Squares are indexed the same way as SquareChange: y * 8 + x.
+   */
+  const std::array<float, 64>& activity() const;
+
+  /**
+   * True between Started and Finished.
+   */
+  bool moving() const;
+
+  /**
+   * Number of consecutive images without movement, 1 for the first image
+   * after a hand left the board.
+   */
+  int still() const;
+
+ private:
+  cv::Mat small;
+  cv::Mat previous;
+  cv::Mat mean;
+  cv::Mat variance;
+  std::array<float, 64> square_activity{};
+  double background_change = 0;
+  double peak_change = 0;
+  int still_frames = 0;
+  bool in_motion = false;
+};
+
+#endif  // MOTION_DETECTOR_H_
@@ -0,0 +1,151 @@
+#include "occupancy.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+/**
+ * Added to feature variances so that a kind of square which always looked
+ * the same during training doesn't make small differences unlikely.
+ */
+const double MIN_VARIANCE = 25;
+
+static bool is_light(int square) {
+  return (square / 8 + square % 8) % 2 == 1;
+}
+
+/**
+ * Occupants of squares as seen by camera. Camera looks at the board at an
+ * angle so a piece covers part of the next square towards the camera's far
+ * side, which is square index + 1 in board image orientation.
+ */
+static void visible(std::array<OccupancyClassifier::Occupant, 64>& occupants) {
+  for (int square = 63; square >= 0; square--) {
+    if (occupants[square] == OccupancyClassifier::Empty && square % 8 != 0) {
+      occupants[square] = occupants[square - 1];
+    }
+  }
+}
+
+static void occupants_of(const chess::Position& position,
+    std::array<OccupancyClassifier::Occupant, 64>& occupants) {
+  for (int square = 0; square < 64; square++) {
+    if (position.pieces[square] == chess::Empty) {
+      occupants[square] = OccupancyClassifier::Empty;
+    } else {
+      occupants[square] = position.color[square] ? OccupancyClassifier::White : OccupancyClassifier::Black;
+    }
+  }
+}
+
+void OccupancyClassifier::features(const cv::Mat& board, Features& result) {
+  // Integral images give sums over any rectangle in constant time
+  cv::integral(board, sum, square_sum, CV_64F, CV_64F);
+  int square_size = board.rows / 8;
+  int margin = square_size / 6;
+  int inner = square_size - 2 * margin;
+  double count = inner * inner;
+  for (int y = 0; y < 8; y++) {
+    int top = y * square_size + margin;
+    const double* sum_top = sum.ptr<double>(top);
+    const double* sum_bottom = sum.ptr<double>(top + inner);
+    const double* square_top = square_sum.ptr<double>(top);
+    const double* square_bottom = square_sum.ptr<double>(top + inner);
+    for (int x = 0; x < 8; x++) {
+      int left = x * square_size + margin;
+      int right = left + inner;
+      double pixels = sum_bottom[right] - sum_top[right] - sum_bottom[left] + sum_top[left];
+      double squares = square_bottom[right] - square_top[right] - square_bottom[left] + square_top[left];
+      double pixel_mean = pixels / count;
+      double deviation = std::sqrt(std::max(squares / count - pixel_mean * pixel_mean, 0.0));
+      // Same indexing as SquareChange
+      result[(7 - x) * 8 + (7 - y)] = {pixel_mean, deviation};
+    }
+  }
+}
+
+bool OccupancyClassifier::train(const cv::Mat& board, const chess::Position& position) {
+  Features board_features;
+  features(board, board_features);
+  std::array<Occupant, 64> occupants;
+  occupants_of(position, occupants);
+  visible(occupants);
+  int count[3][2] = {};
+  for (int occupant = 0; occupant < 3; occupant++) {
+    for (int light = 0; light < 2; light++) {
+      mean[occupant][light] = variance[occupant][light] = {0, 0};
+    }
+  }
+  for (int square = 0; square < 64; square++) {
+    int light = is_light(square);
+    mean[occupants[square]][light] += board_features[square];
+    count[occupants[square]][light]++;
+  }
+  for (int occupant = 0; occupant < 3; occupant++) {
+    for (int light = 0; light < 2; light++) {
+      if (count[occupant][light] == 0) {
+        return false;
+      }
+      mean[occupant][light] /= count[occupant][light];
+    }
+  }
+  for (int square = 0; square < 64; square++) {
+    int light = is_light(square);
+    cv::Vec2d difference = board_features[square] - mean[occupants[square]][light];
+    variance[occupants[square]][light] += difference.mul(difference);
+  }
+  for (int occupant = 0; occupant < 3; occupant++) {
+    for (int light = 0; light < 2; light++) {
+      variance[occupant][light] /= count[occupant][light];
+      variance[occupant][light] += cv::Vec2d(MIN_VARIANCE, MIN_VARIANCE);
+    }
+  }
+  return true;
+}
+
+void OccupancyClassifier::classify(const cv::Mat& board) {
+  Features board_features;
+  features(board, board_features);
+  for (int square = 0; square < 64; square++) {
+    int light = is_light(square);
+    for (int occupant = 0; occupant < 3; occupant++) {
+      double likelihood = 0;
+      for (int i = 0; i < 2; i++) {
+        double difference = board_features[square][i] - mean[occupant][light][i];
+        likelihood -= 0.5 * (difference * difference / variance[occupant][light][i] +
+          std::log(variance[occupant][light][i]));
+      }
+      log_likelihood[square][occupant] = likelihood;
+    }
+  }
+}
+
+std::vector<double> OccupancyClassifier::score(
+    const chess::Position& position, const std::vector<chess::Move>& moves) const {
+  std::array<Occupant, 64> before;
+  occupants_of(position, before);
+  std::vector<double> scores;
+  scores.reserve(moves.size());
+  for (const chess::Move& move : moves) {
+    std::array<Occupant, 64> after = before;
+    chess::Figure piece = position.pieces[move.from];
+    if (piece == chess::King && std::abs(move.from - move.to) == 2) {
+      // Castling, rook jumps over the king
+      int rook = move.to > move.from ? move.from + 3 : move.from - 4;
+      after[(move.from + move.to) / 2] = after[rook];
+      after[rook] = Empty;
+    } else if (piece == chess::Pawn && std::abs(move.from - move.to) % 8 != 0 &&
+        position.pieces[move.to] == chess::Empty) {
+      // En passant
+      after[move.to + (move.from > move.to ? 8 : -8)] = Empty;
+    }
+    after[move.to] = after[move.from];
+    after[move.from] = Empty;
+    visible(after);
+    double score = 0;
+    for (int square = 0; square < 64; square++) {
+      score += log_likelihood[square][after[square]];
+    }
+    scores.push_back(score);
+  }
+  return scores;
+}
@@ -0,0 +1,60 @@
+#ifndef OCCUPANCY_H_
+#define OCCUPANCY_H_
+
+#include "chess_engine.hpp"
+#include <array>
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+/**
+ * Tells how likely each square of a top down grayscale board image is to be
+ * empty or to have a white or a black piece. Appearance of each kind of
+ * square is learned from a board image where position is known, so it adapts
+ * to the chess set and lighting.
+ */
+class OccupancyClassifier {
+ public:
+  enum Occupant {
+    Empty,
+    White,
+    Black
+  };
+
+  /**
+   * Learn appearance of squares from board image where pieces stand as in
+   * given position. Returns false if some kind of square is missing.
+   */
+  bool train(const cv::Mat& board, const chess::Position& position);
+
+  /**
+   * Compute likelihoods of occupants of each square in board image.
+   */
+  void classify(const cv::Mat& board);
+
+  /**
+   * Log likelihood of classified board image showing position after each
+   * of given moves.
+   */
+  std::vector<double> score(const chess::Position& position, const std::vector<chess::Move>& moves) const;
+
+ private:
+  /**
+   * Mean and standard deviation of pixels inside each square.
+   */
+  typedef std::array<cv::Vec2d, 64> Features;
+
+  /**
+   * Feature means and variances for each occupant on light and dark
+   * squares.
+   */
+  cv::Vec2d mean[3][2];
+  cv::Vec2d variance[3][2];
+
+  std::array<std::array<double, 3>, 64> log_likelihood;
+  cv::Mat sum;
+  cv::Mat square_sum;
+
+  void features(const cv::Mat& board, Features& result);
+};
+
+#endif  // OCCUPANCY_H_
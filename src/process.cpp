@@ -1,25 +1,34 @@
 #include "logger.hpp"
 #include "process.hpp"
+#include <csignal>
+#include <sys/wait.h>
 #include <unistd.h>
 
-Process::Process(std::vector<std::string> command) {
+Process::Process(std::vector<std::string> command) : command(command) {
+  // Writing to a crashed process must fail with EPIPE instead of killing us
+  std::signal(SIGPIPE, SIG_IGN);
+  start();
+}
+
+bool Process::start() {
   int stdin_pipe[2], stdout_pipe[2];
   if (pipe(stdin_pipe) == -1) {
     logger::last("Failed to create stdin pipe for process %s", command.front().c_str());
-    return;
+    return false;
   }
   if (pipe(stdout_pipe) == -1) {
     logger::last("Failed to create stdout pipe for process %s", command.front().c_str());
-    return;
+    return false;
   }
   pid_t child_pid = fork();
   if (child_pid == -1) {
     logger::last("Failed to fork for process %s", command.front().c_str());
-    return;
+    return false;
   }
   if (child_pid != 0) {  // This is parent process
     close(stdout_pipe[1]);
     close(stdin_pipe[0]);
+    pid = child_pid;
     read_fd = stdout_pipe[0];
     write_fd = stdin_pipe[1];
   } else { // This is child process
@@ -43,6 +52,7 @@ Process::Process(std::vector<std::string> command) {
       exit(127);
     }
   }
+  return true;
 }
 
 Process::~Process() {
@@ -51,7 +61,35 @@ Process::~Process() {
 }
 
 void Process::write_line(std::string line) {
+  std::lock_guard guard(write_mutex);
   if (write(write_fd, (line + "\n").c_str(), line.size() + 1) == -1) {
     logger::last("Failed to write '%s' to process", line.c_str());
   }
 }
+
+bool Process::restart() {
+  std::lock_guard guard(write_mutex);
+  close(write_fd);
+  close(read_fd);
+  write_fd = read_fd = -1;
+  wait();
+  return start();
+}
+
+void Process::wait() {
+  if (pid == -1) {
+    return;
+  }
+  kill(pid, SIGKILL);
+  int status;
+  if (waitpid(pid, &status, 0) == -1) {
+    logger::last("Failed to wait for process %s", command.front().c_str());
+  } else if (WIFEXITED(status)) {
+    logger::warn("Process %s exited with status %d",
+      command.front().c_str(), WEXITSTATUS(status));
+  } else if (WIFSIGNALED(status)) {
+    logger::warn("Process %s was killed by signal %d",
+      command.front().c_str(), WTERMSIG(status));
+  }
+  pid = -1;
+}
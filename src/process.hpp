@@ -1,7 +1,9 @@
 #ifndef PROCESS_H_
 #define PROCESS_H_
 
+#include <mutex>
 #include <string>
+#include <sys/types.h>
 #include <vector>
 
 class Process {
@@ -15,8 +17,23 @@ class Process {
 
   void write_line(std::string line);
 
-  int read_fd;
-  int write_fd;
+  /**
+   * Kill process if it is still running, reap it and start it again with
+   * the same command. Must be called from the thread reading read_fd.
+   * Return false if new process could not be started.
+   */
+  bool restart();
+
+  int read_fd = -1;
+  int write_fd = -1;
+
+ private:
+  std::vector<std::string> command;
+  pid_t pid = -1;
+  std::mutex write_mutex;
+
+  bool start();
+  void wait();
 };
 
 #endif  // PROCESS_H_
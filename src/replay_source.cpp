@@ -0,0 +1,97 @@
+#include "logger.hpp"
+#include "replay_source.hpp"
+#include <algorithm>
+#include <charconv>
+#include <filesystem>
+#include <optional>
+#include <thread>
+
+using namespace std::chrono_literals;
+
+/**
+ * Time between frames when it is not recorded.
+ */
+const std::chrono::milliseconds FRAME_INTERVAL = 33ms;
+
+/**
+ * Timestamp in milliseconds the file is named with, if its name is a
+ * number.
+ */
+static std::optional<long long> file_time(const std::string& file) {
+  std::string name = std::filesystem::path(file).stem();
+  long long ms;
+  std::from_chars_result result = std::from_chars(name.data(), name.data() + name.size(), ms);
+  if (result.ec == std::errc() && result.ptr == name.data() + name.size()) {
+    return ms;
+  }
+  return std::nullopt;
+}
+
+ReplaySource::ReplaySource(std::string path, Pacing pacing, int repeat)
+    : pacing(pacing), repeat(std::max(repeat, 1)) {
+  if (std::filesystem::is_directory(path) || path.find('*') != std::string::npos) {
+    cv::glob(path, files, false);
+  } else if (!video.open(path)) {
+    logger::error("Failed to open video %s", path.c_str());
+  }
+  if (!files.empty()) {
+    std::sort(files.begin(), files.end());
+    // Timestamps are not necessarily padded to the same length
+    if (std::all_of(files.begin(), files.end(), [](const cv::String& file) {
+          return file_time(file).has_value();
+        })) {
+      std::stable_sort(files.begin(), files.end(), [](const cv::String& a, const cv::String& b) {
+        return file_time(a).value() < file_time(b).value();
+      });
+    }
+  }
+}
+
+ReplaySource::Pacing ReplaySource::get_pacing() const {
+  return pacing;
+}
+
+bool ReplaySource::read(Frame& frame, std::chrono::milliseconds& time) {
+  if (video.isOpened()) {
+    if (!video.read(frame.image)) {
+      return false;
+    }
+    time = std::chrono::milliseconds((long long)video.get(cv::CAP_PROP_POS_MSEC));
+    return true;
+  }
+  if (repeated == 0) {
+    do {
+      if (file_index == files.size()) {
+        return false;
+      }
+      image = cv::imread(files[file_index++]);
+    } while (image.empty());
+    if (std::optional<long long> ms = file_time(files[file_index - 1])) {
+      image_time = std::chrono::milliseconds(ms.value());
+    } else {
+      image_time = FRAME_INTERVAL * (std::int64_t)sequence;
+    }
+  }
+  time = image_time + FRAME_INTERVAL * repeated;
+  repeated = (repeated + 1) % repeat;
+  image.copyTo(frame.image);
+  return true;
+}
+
+bool ReplaySource::next(Frame& frame) {
+  std::chrono::milliseconds time;
+  if (!read(frame, time)) {
+    return false;
+  }
+  if (sequence == 0) {
+    start = std::chrono::steady_clock::now() - time;
+  }
+  frame.format = 0;
+  frame.buffer = -1;
+  frame.sequence = sequence++;
+  frame.timestamp = start + time;
+  if (pacing == Pacing::RealTime) {
+    std::this_thread::sleep_until(frame.timestamp);
+  }
+  return true;
+}
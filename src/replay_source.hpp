@@ -0,0 +1,62 @@
+#ifndef REPLAY_SOURCE_H_
+#define REPLAY_SOURCE_H_
+
+#include "frame.hpp"
+#include <chrono>
+#include <cstdint>
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+
+/**
+ * Recorded frames played back instead of the camera.
+ */
+class ReplaySource {
+ public:
+  enum class Pacing {
+    /**
+     * Frames are returned as fast as they are read, none is dropped.
+     */
+    Fast,
+
+    /**
+     * Frames are returned at the rate they were recorded, slow processing
+     * drops them as it would with camera.
+     */
+    RealTime
+  };
+
+  /**
+   * Path is either a video file, a directory of images or a file name
+   * pattern like "boards/move*.jpg". Images are played in file name order.
+   * If all names are numbers they are taken as timestamps in milliseconds
+   * and images are played in their order.
+   * Each image is repeated given number of times, at least once, so that
+   * still images look like a still board to motion detection.
+   */
+  ReplaySource(std::string path, Pacing pacing = Pacing::Fast, int repeat = 1);
+
+  /**
+   * Read next BGR frame, waiting until it is due in real time pacing.
+   * Returns false at the end.
+   */
+  bool next(Frame& frame);
+
+  Pacing get_pacing() const;
+
+ private:
+  Pacing pacing;
+  int repeat;
+  cv::VideoCapture video;
+  std::vector<cv::String> files;
+  std::size_t file_index = 0;
+  int repeated = 0;
+  cv::Mat image;
+  std::chrono::milliseconds image_time;
+  std::uint64_t sequence = 0;
+  std::chrono::steady_clock::time_point start;
+
+  bool read(Frame& frame, std::chrono::milliseconds& time);
+};
+
+#endif  // REPLAY_SOURCE_H_
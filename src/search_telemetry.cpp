@@ -0,0 +1,118 @@
+#include "logger.hpp"
+#include "search_telemetry.hpp"
+#include "uci.hpp"
+
+static std::chrono::milliseconds since(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::steady_clock::now() - start);
+}
+
+std::string SearchRecord::to_string() const {
+  std::string result = command + ":";
+  if (!timeline.empty()) {
+    result += " depth " + std::to_string(timeline.back().depth) +
+      "/" + std::to_string(timeline.back().seldepth);
+  }
+  if (score) {
+    result += score->unit == chess::ScoreUnit::Centipawn ? " cp " : " mate ";
+    result += std::to_string(score->value);
+  }
+  result += " in " + std::to_string(duration.count()) + "ms";
+  result += ", nodes " + std::to_string(nodes);
+  result += ", nps " + std::to_string(nps);
+  result += ", hashfull " + std::to_string(hashfull);
+  if (!finished) {
+    result += ", cut short";
+  }
+  if (!pv.empty()) {
+    result += ", pv " + pv;
+  }
+  return result;
+}
+
+void SearchTelemetry::clear() {
+  std::lock_guard guard(mutex);
+  searches.clear();
+  searching = false;
+}
+
+void SearchTelemetry::start(std::string command) {
+  std::lock_guard guard(mutex);
+  SearchRecord record;
+  record.command = command;
+  record.start = std::chrono::steady_clock::now();
+  searches.push_back(record);
+  searching = true;
+}
+
+void SearchTelemetry::add(const Info& info) {
+  std::lock_guard guard(mutex);
+  if (!searching) {
+    return;
+  }
+  SearchRecord& record = searches.back();
+  if (info.nodes) {
+    record.nodes = info.nodes.value();
+  }
+  if (info.nps) {
+    record.nps = info.nps.value();
+  }
+  if (info.hashfull) {
+    record.hashfull = info.hashfull.value();
+  }
+  if (info.depth && (record.timeline.empty() || record.timeline.back().depth != info.depth.value())) {
+    record.timeline.push_back({
+      since(record.start),
+      info.depth.value(),
+      info.seldepth.value_or(0),
+      record.nodes,
+      record.nps
+    });
+  }
+  if (info.score && info.bound == ScoreBound::Exact) {
+    record.score = info.score;
+    record.pv = info.pv;
+  }
+}
+
+void SearchTelemetry::finish() {
+  std::lock_guard guard(mutex);
+  if (searching) {
+    searches.back().duration = since(searches.back().start);
+    searches.back().finished = true;
+    searching = false;
+  }
+}
+
+void SearchTelemetry::abandon() {
+  std::lock_guard guard(mutex);
+  if (searching) {
+    searches.back().duration = since(searches.back().start);
+    searching = false;
+  }
+}
+
+std::vector<SearchRecord> SearchTelemetry::records() {
+  std::lock_guard guard(mutex);
+  return searches;
+}
+
+void SearchTelemetry::log() {
+  std::lock_guard guard(mutex);
+  int cut_short = 0;
+  std::chrono::milliseconds total(0);
+  for (auto& record : searches) {
+    logger::debug("Search %s", record.to_string().c_str());
+    for (auto& depth : record.timeline) {
+      logger::debug("  depth %d/%d at %dms, nodes %llu, nps %llu",
+        depth.depth, depth.seldepth, (int)depth.elapsed.count(),
+        (unsigned long long)depth.nodes, (unsigned long long)depth.nps);
+    }
+    if (!record.finished) {
+      cut_short++;
+    }
+    total += record.duration;
+  }
+  logger::info("Engine ran %d searches in %dms, %d cut short",
+    (int)searches.size(), (int)total.count(), cut_short);
+}
@@ -0,0 +1,109 @@
+#ifndef SEARCH_TELEMETRY_H_
+#define SEARCH_TELEMETRY_H_
+
+#include "chess_engine.hpp"
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+class Info;
+
+/**
+ * State of the search at the moment engine reported a new depth.
+ */
+class DepthReached {
+ public:
+  std::chrono::milliseconds elapsed;
+  int depth;
+  int seldepth;
+  std::uint64_t nodes;
+  std::uint64_t nps;
+};
+
+/**
+ * Everything engine reported during a single "go" command.
+ */
+class SearchRecord {
+ public:
+  std::string command;
+  std::chrono::steady_clock::time_point start;
+
+  /**
+   * Time between sending "go" and receiving "bestmove" or abandoning the
+   * search.
+   */
+  std::chrono::milliseconds duration{0};
+  std::vector<DepthReached> timeline;
+  std::optional<chess::Score> score;
+  std::uint64_t nodes = 0;
+  std::uint64_t nps = 0;
+
+  /**
+   * How full the hash table is in permille.
+   */
+  int hashfull = 0;
+
+  /**
+   * Principal variation of the last exact score.
+   */
+  std::string pv;
+
+  /**
+   * True if engine finished the search by itself, false if search was
+   * abandoned because of timeout.
+   */
+  bool finished = false;
+
+  std::string to_string() const;
+};
+
+/**
+ * Collects structured records of engine searches.
+ */
+class SearchTelemetry {
+ public:
+  /**
+   * Forget all previous records.
+   */
+  void clear();
+
+  /**
+   * Start a new record for given "go" command.
+   */
+  void start(std::string command);
+
+  /**
+   * Add fields of info line to the current record.
+   */
+  void add(const Info& info);
+
+  /**
+   * Engine reported best move so current record is complete.
+   */
+  void finish();
+
+  /**
+   * Current record is no longer waited for.
+   */
+  void abandon();
+
+  /**
+   * Return copy of records since last clear.
+   */
+  std::vector<SearchRecord> records();
+
+  /**
+   * Log summary of all records and their depth timelines.
+   */
+  void log();
+
+ private:
+  std::mutex mutex;
+  std::vector<SearchRecord> searches;
+  bool searching = false;
+};
+
+#endif  // SEARCH_TELEMETRY_H_
@@ -0,0 +1 @@
+#include "spscq.hpp"
@@ -0,0 +1,79 @@
+#ifndef SPSCQ_H_
+#define SPSCQ_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+namespace spscq {
+
+/**
+ * Single Producer Single Consumer ring of preallocated slots. Slots are
+ * reused so data stored in them (like image buffers) is not reallocated.
+ */
+template <typename T, std::size_t N>
+class Ring {
+ public:
+  /**
+   * Return next free slot to be filled by producer or nullptr if ring is
+   * full.
+   */
+  T* acquire() {
+    std::size_t head_now = head.load(std::memory_order_relaxed);
+    if (head_now - tail.load(std::memory_order_acquire) == N) {
+      return nullptr;
+    }
+    return &slots[head_now % N];
+  }
+
+  /**
+   * Block until consumer releases a slot and return it.
+   */
+  T& wait_acquire() {
+    std::size_t head_now = head.load(std::memory_order_relaxed);
+    for (std::size_t tail_now = tail.load(std::memory_order_acquire);
+        head_now - tail_now == N;
+        tail_now = tail.load(std::memory_order_acquire)) {
+      tail.wait(tail_now, std::memory_order_acquire);
+    }
+    return slots[head_now % N];
+  }
+
+  /**
+   * Make slot returned by acquire available to consumer.
+   */
+  void publish() {
+    head.fetch_add(1, std::memory_order_release);
+    head.notify_one();
+  }
+
+  /**
+   * Block until producer publishes a slot and return the oldest one.
+   */
+  T& consume() {
+    std::size_t tail_now = tail.load(std::memory_order_relaxed);
+    for (std::size_t head_now = head.load(std::memory_order_acquire);
+        head_now == tail_now;
+        head_now = head.load(std::memory_order_acquire)) {
+      head.wait(head_now, std::memory_order_acquire);
+    }
+    return slots[tail_now % N];
+  }
+
+  /**
+   * Give slot returned by consume back to producer.
+   */
+  void release() {
+    tail.fetch_add(1, std::memory_order_release);
+    tail.notify_one();
+  }
+
+ private:
+  std::array<T, N> slots;
+  alignas(64) std::atomic<std::size_t> head = 0;
+  alignas(64) std::atomic<std::size_t> tail = 0;
+};
+
+}  // namespace spscq
+
+#endif  // SPSCQ_H_
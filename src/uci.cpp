@@ -1,45 +1,172 @@
+#include "line_reader.hpp"
 #include "logger.hpp"
 #include "uci.hpp"
-#include <cstdio>
-#include <regex>
-#include <thread>
+#include <algorithm>
+#include <charconv>
+
+/**
+ * Return next space separated token and remove it from the line.
+ */
+static std::string_view next_token(std::string_view& line) {
+  std::size_t start = line.find_first_not_of(' ');
+  if (start == line.npos) {
+    line = {};
+    return {};
+  }
+  line.remove_prefix(start);
+  std::size_t end = std::min(line.find(' '), line.size());
+  std::string_view token = line.substr(0, end);
+  line.remove_prefix(end);
+  return token;
+}
+
+template <typename T>
+static std::optional<T> parse_number(std::string_view token) {
+  T value;
+  auto [end, error] = std::from_chars(token.data(), token.data() + token.size(), value);
+  if (error != std::errc() || end != token.data() + token.size()) {
+    return std::nullopt;
+  }
+  return value;
+}
+
+static bool is_move(std::string_view token) {
+  return (token.size() == 4 || token.size() == 5) &&
+    token[0] >= 'a' && token[0] <= 'h' && token[1] >= '1' && token[1] <= '8' &&
+    token[2] >= 'a' && token[2] <= 'h' && token[3] >= '1' && token[3] <= '8';
+}
+
+std::optional<Info> parse_info(std::string_view line) {
+  if (next_token(line) != "info") {
+    return std::nullopt;
+  }
+  Info info;
+  for (std::string_view token = next_token(line); !token.empty(); token = next_token(line)) {
+    if (token == "depth") {
+      info.depth = parse_number<int>(next_token(line));
+    } else if (token == "seldepth") {
+      info.seldepth = parse_number<int>(next_token(line));
+    } else if (token == "multipv") {
+      info.multipv = parse_number<int>(next_token(line));
+    } else if (token == "nodes") {
+      info.nodes = parse_number<std::uint64_t>(next_token(line));
+    } else if (token == "nps") {
+      info.nps = parse_number<std::uint64_t>(next_token(line));
+    } else if (token == "hashfull") {
+      info.hashfull = parse_number<int>(next_token(line));
+    } else if (token == "score") {
+      std::string_view unit = next_token(line);
+      std::optional<int> value = parse_number<int>(next_token(line));
+      if (value && (unit == "cp" || unit == "mate")) {
+        info.score = {
+          value.value(),
+          unit == "cp" ? chess::ScoreUnit::Centipawn : chess::ScoreUnit::MateIn,
+          0
+        };
+      }
+    } else if (token == "lowerbound") {
+      info.bound = ScoreBound::Lower;
+    } else if (token == "upperbound") {
+      info.bound = ScoreBound::Upper;
+    } else if (token == "pv") {
+      const char* pv_start = nullptr;
+      std::string_view rest = line;
+      for (std::string_view move = next_token(rest); is_move(move); move = next_token(rest)) {
+        if (pv_start == nullptr) {
+          pv_start = move.data();
+        }
+        info.pv = std::string_view(pv_start, move.data() + move.size() - pv_start);
+        line = rest;
+      }
+    } else if (token == "string") {
+      break;  // Rest of the line is free form text
+    }
+  }
+  if (info.score) {
+    info.score->depth = info.depth.value_or(0);
+  }
+  return info;
+}
 
 UniversalChessInterface::UniversalChessInterface(std::string command)
-    : process({command.c_str()}) {
-  std::thread read_thread(&UniversalChessInterface::read, this);
-  read_thread.detach();
+    : UniversalChessInterface(std::vector<std::string>({command})) {
+}
+
+UniversalChessInterface::UniversalChessInterface(std::vector<std::string> command)
+    : process(command) {
+  read_thread = std::thread(&UniversalChessInterface::read, this);
+  handshake();
+}
+
+UniversalChessInterface::~UniversalChessInterface() {
+  quitting = true;
+  process.write_line("quit");
+  read_thread.join();
 }
 
 void UniversalChessInterface::read() {
-  FILE *input = fdopen(process.read_fd, "r");
-  char buffer[1024];
-  while (fgets(buffer, sizeof(buffer), input) != NULL) {
-    std::string line(buffer);
-    if (line.ends_with("\n")) {
-      line = line.substr(0, line.size() - 1);
+  for ( ; ; ) {
+    LineReader reader(process.read_fd);
+    while (reader.read([this](std::string_view line) {
+      process_line(line);
+    })) {
     }
-    logger::debug("uci: %s", line.c_str());
-    process_line(line);
+    if (quitting) {
+      return;
+    }
+    if (++failed_restarts > 3) {
+      logger::error("Chess engine keeps crashing, giving up");
+      return;
+    }
+    logger::error("Chess engine closed its output, restarting");
+    if (!process.restart()) {
+      return;
+    }
+    restart();
+  }
+}
+
+void UniversalChessInterface::handshake() {
+  process.write_line("uci");
+  process.write_line("isready");
+}
+
+void UniversalChessInterface::restart() {
+  handshake();
+  std::lock_guard guard(score_mutex);
+  if (!position_command.empty()) {
+    process.write_line(position_command);
+  }
+  if (pending_searches > 0) {
+    // Bestmove of the crashed searches will never come, repeat only the last one
+    pending_searches = 1;
+    process.write_line(search_command);
   }
-  fclose(input);
 }
 
-void UniversalChessInterface::process_line(std::string line) {
-  if (line.starts_with("info depth")) {
-    size_t index = line.find("score");
-    if (index != line.npos) {
-      chess::ScoreUnit unit = line.at(index + 6) == 'c' ?
-        chess::ScoreUnit::Centipawn : chess::ScoreUnit::MateIn;
-      size_t value_start = line.find(' ', index + 6);
-      size_t value_end = line.find(' ', value_start + 1);
+void UniversalChessInterface::process_line(std::string_view line) {
+  std::optional<Info> info = parse_info(line);
+  if (!info) {
+    logger::debug("uci: %.*s", (int)line.size(), line.data());
+    if (line == "readyok") {
+      failed_restarts = 0;
+    } else if (line.starts_with("bestmove")) {
       std::lock_guard guard(score_mutex);
-      score = {
-        std::atoi(line.substr(value_start + 1, value_end - value_start - 1).c_str()),
-        unit,
-        std::atoi(line.substr(11, line.find(' ', 12) - 11).c_str())
-      };
+      if (pending_searches > 0 && --pending_searches == 0) {
+        telemetry.finish();
+      }
       score_found.notify_all();
     }
+    return;
+  }
+  std::lock_guard guard(score_mutex);
+  if (pending_searches > 1) {
+    return;  // Line belongs to the search which was already stopped
+  }
+  telemetry.add(info.value());
+  if (info->depth && info->score && info->bound == ScoreBound::Exact) {
+    score = info->score;
+    score_found.notify_all();
   }
 }
 
@@ -49,6 +176,8 @@ void UniversalChessInterface::send_position(const chess::Position& position) {
     start_position += " ";
     start_position += move.to_string();
   }
+  std::lock_guard guard(score_mutex);
+  position_command = start_position;
   process.write_line(start_position);
 }
 
@@ -59,28 +188,78 @@ std::vector<chess::EvaluatedMove> UniversalChessInterface::evaluate_moves(
     const std::chrono::milliseconds timeout) {
   std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
   end += timeout;
+  telemetry.clear();
   send_position(position);
   std::vector<chess::EvaluatedMove> result;
   for (auto& move : moves) {
-    process.write_line("go depth " + std::to_string(depth) + " searchmoves " + move.to_string());
-    for ( ; ; ) {
-      std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
-      std::unique_lock<std::mutex> lock(score_mutex);
+    std::string command = "go depth " + std::to_string(depth) + " searchmoves " + move.to_string();
+    telemetry.start(command);
+    {
+      // Sent under the lock so restart can't repeat a search not sent yet
+      std::lock_guard guard(score_mutex);
       score.reset();
-      if (score_found.wait_for(lock, end - now) == std::cv_status::no_timeout) {
-        if (score.has_value()) {
-          if (score.value().depth == depth) {
-            result.emplace(result.end(), move, score.value());
-            break;
-          }
-        } else {
-          return result;
-        }
-      } else {
-        return result;
-      }
+      pending_searches++;
+      search_command = command;
+      process.write_line(command);
+    }
+    std::unique_lock<std::mutex> lock(score_mutex);
+    if (!score_found.wait_until(lock, end, [this]() { return pending_searches == 0; })) {
+      lock.unlock();
+      telemetry.abandon();
+      process.write_line("stop");
+      break;
+    }
+    if (score.has_value() && score.value().depth == depth) {
+      result.emplace(result.end(), move, score.value());
+    }
+  }
+  telemetry.log();
+  std::stable_sort(result.begin(), result.end());
+  return result;
+}
+
+std::vector<chess::EvaluatedMove> UniversalChessInterface::evaluate_moves_within(
+    const chess::Position& position,
+    const std::vector<chess::Move>& moves,
+    const std::chrono::milliseconds budget) {
+  std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+  end += budget;
+  telemetry.clear();
+  send_position(position);
+  std::vector<chess::EvaluatedMove> result;
+  for (std::size_t i = 0; i < moves.size(); i++) {
+    const chess::Move& move = moves[i];
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (now >= end) {
+      break;
+    }
+    // Infinite search only ends when stopped, so each move gets an equal
+    // share of what is left and time lost to engine latency is absorbed by
+    // the following moves
+    std::chrono::steady_clock::time_point move_end = now + (end - now) / (moves.size() - i);
+    std::string command = "go infinite searchmoves " + move.to_string();
+    telemetry.start(command);
+    {
+      // Sent under the lock so restart can't repeat a search not sent yet
+      std::lock_guard guard(score_mutex);
+      score.reset();
+      pending_searches++;
+      search_command = command;
+      process.write_line(command);
+    }
+    std::unique_lock<std::mutex> lock(score_mutex);
+    bool finished = score_found.wait_until(lock, move_end, [this]() { return pending_searches == 0; });
+    std::optional<chess::Score> deepest = score;
+    lock.unlock();
+    if (!finished) {
+      telemetry.abandon();
+      process.write_line("stop");
+    }
+    if (deepest.has_value()) {
+      result.emplace(result.end(), move, deepest.value());
     }
   }
+  telemetry.log();
   std::stable_sort(result.begin(), result.end());
   return result;
 }
@@ -3,35 +3,118 @@
 
 #include "chess_engine.hpp"
 #include "process.hpp"
+#include "search_telemetry.hpp"
+#include <atomic>
 #include <condition_variable>
 #include <chrono>
+#include <cstdint>
 #include <memory>
 #include <mutex>
 #include <optional>
+#include <string_view>
+#include <thread>
 #include <vector>
 
 using namespace std::chrono_literals;
 
+/**
+ * Tells if score reported by engine is exact or only a bound of it.
+ */
+enum class ScoreBound {
+  Exact,
+  Lower,
+  Upper
+};
+
+/**
+ * Fields parsed from UCI "info" line. Missing fields are not set. Principal
+ * variation points into the line it was parsed from.
+ */
+class Info {
+ public:
+  std::optional<int> depth;
+  std::optional<int> seldepth;
+  std::optional<int> multipv;
+  std::optional<chess::Score> score;
+  ScoreBound bound = ScoreBound::Exact;
+  std::optional<std::uint64_t> nodes;
+  std::optional<std::uint64_t> nps;
+  std::optional<int> hashfull;
+
+  /**
+   * Space separated moves of principal variation.
+   */
+  std::string_view pv;
+};
+
+/**
+ * Parse UCI "info" line without allocating memory. Return nullopt if line
+ * is not an "info" line.
+ */
+std::optional<Info> parse_info(std::string_view line);
+
 class UniversalChessInterface {
  public:
   UniversalChessInterface(std::string command);
 
+  /**
+   * Start engine with command line arguments.
+   */
+  UniversalChessInterface(std::vector<std::string> command);
+
+  /**
+   * Ask engine to quit and wait until it closes its output.
+   */
+  virtual ~UniversalChessInterface();
+
   std::vector<chess::EvaluatedMove> evaluate_moves(
     const chess::Position& position,
     const std::vector<chess::Move>& moves,
     const int depth = 10,
     const std::chrono::milliseconds timeout = 3s);
 
+  /**
+   * Evaluate moves as deeply as possible within given time budget. Each move
+   * gets an equal share of the remaining budget and keeps the score of the
+   * deepest iteration engine completed before it was stopped.
+   */
+  std::vector<chess::EvaluatedMove> evaluate_moves_within(
+    const chess::Position& position,
+    const std::vector<chess::Move>& moves,
+    const std::chrono::milliseconds budget = 3s);
+
+  /**
+   * Records of searches made by the last evaluate_moves or
+   * evaluate_moves_within call.
+   */
+  SearchTelemetry telemetry;
+
  protected:
   Process process;
   std::mutex score_mutex;
   std::condition_variable score_found;
   std::optional<chess::Score> score;
+
+  /**
+   * Number of "go" commands not yet answered with "bestmove".
+   */
+  int pending_searches = 0;
+
+  /**
+   * Last commands sent to engine so they can be replayed after a crash.
+   */
+  std::string position_command;
+  std::string search_command;
   void send_position(const chess::Position& position);
-  virtual void process_line(std::string line);
+  virtual void process_line(std::string_view line);
 
  private:
+  std::thread read_thread;
+  std::atomic<bool> quitting = false;
+  int failed_restarts = 0;
   void read();
+  void handshake();
+  void restart();
 };
 
 #endif  // UCI_H_
@@ -0,0 +1,202 @@
+#include "logger.hpp"
+#include "v4l2_camera.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/videodev2.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/**
+ * Number of buffers requested from the driver. Some are held by frames
+ * waiting to be processed while driver fills the rest.
+ */
+const int BUFFER_COUNT = 8;
+
+/**
+ * Supported pixel formats in order of preference.
+ */
+const std::uint32_t FORMATS[] = {
+  V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_YUYV, V4L2_PIX_FMT_MJPEG
+};
+
+static int xioctl(int fd, unsigned long request, void* arg) {
+  int result;
+  do {
+    result = ioctl(fd, request, arg);
+  } while (result == -1 && errno == EINTR);
+  return result;
+}
+
+V4l2Camera::V4l2Camera(std::string device) : device(device) {
+}
+
+V4l2Camera::~V4l2Camera() {
+  close();
+}
+
+bool V4l2Camera::open(int width, int height) {
+  fd = ::open(device.c_str(), O_RDWR);
+  if (fd == -1) {
+    logger::last("Failed to open %s", device.c_str());
+    return false;
+  }
+  if (!set_format(width, height) || !map_buffers()) {
+    close();
+    return false;
+  }
+  for (int i = 0; i < buffers.size(); i++) {
+    v4l2_buffer buffer = {};
+    buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buffer.memory = V4L2_MEMORY_MMAP;
+    buffer.index = i;
+    if (xioctl(fd, VIDIOC_QBUF, &buffer) == -1) {
+      logger::last("Failed to queue buffer %d", i);
+      close();
+      return false;
+    }
+  }
+  v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  if (xioctl(fd, VIDIOC_STREAMON, &type) == -1) {
+    logger::last("Failed to start streaming from %s", device.c_str());
+    close();
+    return false;
+  }
+  streaming = true;
+  return true;
+}
+
+bool V4l2Camera::set_format(int width, int height) {
+  for (std::uint32_t pixel_format : FORMATS) {
+    v4l2_format fmt = {};
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    fmt.fmt.pix.width = width;
+    fmt.fmt.pix.height = height;
+    fmt.fmt.pix.pixelformat = pixel_format;
+    fmt.fmt.pix.field = V4L2_FIELD_NONE;
+    if (xioctl(fd, VIDIOC_S_FMT, &fmt) == -1) {
+      logger::last("Failed to set format of %s", device.c_str());
+      return false;
+    }
+    // Driver replaces unsupported format with one it supports
+    if (fmt.fmt.pix.pixelformat == pixel_format) {
+      format = pixel_format;
+      this->width = fmt.fmt.pix.width;
+      this->height = fmt.fmt.pix.height;
+      stride = fmt.fmt.pix.bytesperline;
+      logger::info("Capturing %dx%d %.4s frames from %s", this->width, this->height,
+        (const char*)&format, device.c_str());
+      return true;
+    }
+  }
+  logger::error("Camera %s doesn't support NV12, YUYV or MJPEG format", device.c_str());
+  return false;
+}
+
+bool V4l2Camera::map_buffers() {
+  v4l2_requestbuffers request = {};
+  request.count = BUFFER_COUNT;
+  request.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  request.memory = V4L2_MEMORY_MMAP;
+  if (xioctl(fd, VIDIOC_REQBUFS, &request) == -1) {
+    logger::last("Failed to request buffers from %s", device.c_str());
+    return false;
+  }
+  for (int i = 0; i < request.count; i++) {
+    v4l2_buffer buffer = {};
+    buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buffer.memory = V4L2_MEMORY_MMAP;
+    buffer.index = i;
+    if (xioctl(fd, VIDIOC_QUERYBUF, &buffer) == -1) {
+      logger::last("Failed to query buffer %d", i);
+      return false;
+    }
+    void* start = mmap(nullptr, buffer.length, PROT_READ | PROT_WRITE, MAP_SHARED,
+      fd, buffer.m.offset);
+    if (start == MAP_FAILED) {
+      logger::last("Failed to map buffer %d", i);
+      return false;
+    }
+    buffers.push_back({start, buffer.length});
+  }
+  return true;
+}
+
+void V4l2Camera::close() {
+  if (fd == -1) {
+    return;
+  }
+  if (streaming) {
+    streaming = false;
+    v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    xioctl(fd, VIDIOC_STREAMOFF, &type);
+  }
+  // Frames still point into the buffers
+  for (int count = held.load(); count > 0; count = held.load()) {
+    held.wait(count);
+  }
+  for (Buffer& buffer : buffers) {
+    munmap(buffer.start, buffer.length);
+  }
+  buffers.clear();
+  v4l2_requestbuffers request = {};
+  request.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  request.memory = V4L2_MEMORY_MMAP;
+  xioctl(fd, VIDIOC_REQBUFS, &request);
+  ::close(fd);
+  fd = -1;
+}
+
+bool V4l2Camera::grab(Frame& frame) {
+  v4l2_buffer buffer = {};
+  buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  buffer.memory = V4L2_MEMORY_MMAP;
+  if (xioctl(fd, VIDIOC_DQBUF, &buffer) == -1) {
+    logger::last("Failed to dequeue buffer from %s", device.c_str());
+    return false;
+  }
+  held++;
+  if (buffer.flags & V4L2_BUF_FLAG_ERROR) {
+    logger::warn("Dropping corrupted frame %u", buffer.sequence);
+    release(buffer.index);
+    return false;
+  }
+  std::uint8_t* data = (std::uint8_t*)buffers[buffer.index].start;
+  switch (format) {
+    case V4L2_PIX_FMT_NV12:
+      frame.image = cv::Mat(height * 3 / 2, width, CV_8UC1, data, stride);
+      break;
+    case V4L2_PIX_FMT_YUYV:
+      frame.image = cv::Mat(height, width, CV_8UC2, data, stride);
+      break;
+    default:
+      frame.image = cv::Mat(1, buffer.bytesused, CV_8UC1, data);
+  }
+  frame.format = format;
+  frame.buffer = buffer.index;
+  frame.sequence = buffer.sequence;
+  if ((buffer.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC) {
+    // CLOCK_MONOTONIC is the clock behind steady_clock on Linux
+    frame.timestamp = std::chrono::steady_clock::time_point(
+      std::chrono::seconds(buffer.timestamp.tv_sec) +
+      std::chrono::microseconds(buffer.timestamp.tv_usec));
+  } else {
+    frame.timestamp = std::chrono::steady_clock::now();
+  }
+  return true;
+}
+
+void V4l2Camera::release(int index) {
+  if (streaming) {
+    v4l2_buffer buffer = {};
+    buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buffer.memory = V4L2_MEMORY_MMAP;
+    buffer.index = index;
+    if (xioctl(fd, VIDIOC_QBUF, &buffer) == -1) {
+      logger::last("Failed to queue buffer %d", index);
+    }
+  }
+  held--;
+  held.notify_all();
+}
@@ -0,0 +1,65 @@
+#ifndef V4L2_CAMERA_H_
+#define V4L2_CAMERA_H_
+
+#include "frame.hpp"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Camera accessed directly through V4L2 memory mapped buffers. Frames are
+ * handed out without copying or colour conversion, each holding camera
+ * buffer until it is released.
+ */
+class V4l2Camera {
+ public:
+  V4l2Camera(std::string device);
+  ~V4l2Camera();
+
+  /**
+   * Open the device and start streaming frames of given size. Formats with
+   * luma plane (NV12, YUYV) are preferred over MJPEG.
+   */
+  bool open(int width, int height);
+
+  /**
+   * Stop streaming and close the device. Blocks until all frames are
+   * released.
+   */
+  void close();
+
+  /**
+   * Block until next frame is captured and point frame image to it. Frame
+   * timestamp and sequence come from the driver.
+   */
+  bool grab(Frame& frame);
+
+  /**
+   * Give buffer of a grabbed frame back to the camera.
+   */
+  void release(int index);
+
+ private:
+  class Buffer {
+   public:
+    void* start;
+    std::size_t length;
+  };
+
+  std::string device;
+  int fd = -1;
+  std::uint32_t format;
+  int width;
+  int height;
+  int stride;
+  std::vector<Buffer> buffers;
+  std::atomic<bool> streaming = false;
+  std::atomic<int> held = 0;
+
+  bool set_format(int width, int height);
+  bool map_buffers();
+};
+
+#endif  // V4L2_CAMERA_H_
@@ -1,8 +1,12 @@
+#include "calibration.hpp"
+#include "debug_images.hpp"
 #include "logger.hpp"
 #include "video_capture.hpp"
+#include <opencv2/core/hal/intrin.hpp>
 #include <algorithm>
+#include <climits>
 #include <cmath>
-#include <filesystem>
+#include <future>
 #include <map>
 #include <numeric>
 #include <optional>
@@ -15,6 +19,46 @@
 
 using namespace std::chrono_literals;
 
+/**
+ * How often to check if board moved while nothing happens on it.
+ */
+const std::chrono::milliseconds TRACK_INTERVAL = 1s;
+
+/**
+ * How long to wait before trying again when camera fails to give a frame.
+ */
+const std::chrono::milliseconds CAPTURE_RETRY_INTERVAL = 100ms;
+
+/**
+ * Default number of still frames to confirm a move with.
+ */
+const int CONFIRMATION_FRAMES = 3;
+
+/**
+ * Smallest calibration_match of saved board calibration with the frame at
+ * game start to skip detect_board. Allows misalignment of a few pixels which
+ * tracking deals with anyway.
+ */
+const double MIN_CALIBRATION_MATCH = 0.8;
+
+/**
+ * Default side of top down board image moves are recognised in, half of
+ * the resolution board is detected in.
+ */
+const int ANALYSIS_SIZE = VIDEO_HEIGHT / 2;
+
+/**
+ * Smallest standard deviation of square pixels match_lighting assumes, so
+ * that noise of plain squares is not amplified.
+ */
+const float MIN_SQUARE_DEVIATION = 4.0f;
+
+/**
+ * How fast board image moves are compared to follows still board between
+ * moves, per frame.
+ */
+const double REFERENCE_LEARNING_RATE = 0.02;
+
 class Square {
  public:
   std::vector<cv::Point> polygon;
@@ -81,16 +125,188 @@ cv::Point line_intersection(Line line1, Line line2) {
   return cv::Point((int)x, (int)y);
 }
 
+void square_changes(const cv::Mat& diff, int margin, SquareChange changes[64]) {
+  CV_Assert(diff.type() == CV_8UC1 && diff.rows == diff.cols);
+  int square_size = diff.cols / 8;
+  int width = square_size * 8;
+  int inner = square_size - margin;
+  CV_Assert(inner * 255 <= USHRT_MAX);  // Column sums of a square must fit into 16 bits
+  cv::AutoBuffer<ushort> buffer(width);
+  ushort* column_sums = buffer.data();
+  for (int y = 0; y < 8; y++) {
+    std::fill(column_sums, column_sums + width, 0);
+    int top = y * square_size + margin / 2;
+    for (int row = top; row < top + inner; row++) {
+      const uchar* pixels = diff.ptr<uchar>(row);
+      int i = 0;
+#if CV_SIMD
+      for ( ; i <= width - cv::v_uint8::nlanes; i += cv::v_uint8::nlanes) {
+        cv::v_uint16 low, high;
+        cv::v_expand(cv::vx_load(pixels + i), low, high);
+        ushort* sums = column_sums + i;
+        cv::v_store(sums, cv::vx_load(sums) + low);
+        cv::v_store(sums + cv::v_uint16::nlanes, cv::vx_load(sums + cv::v_uint16::nlanes) + high);
+      }
+#endif
+      for ( ; i < width; i++) {
+        column_sums[i] += pixels[i];
+      }
+    }
+    for (int x = 0; x < 8; x++) {
+      int left = x * square_size + margin / 2;
+      double sum = 0;
+      for (int i = left; i < left + inner; i++) {
+        sum += column_sums[i];
+      }
+      changes[y * 8 + x] = {x, y, (7 - x) * 8 + (7 - y), sum};
+    }
+  }
+}
+
+void ChangeVote::clear() {
+  top_squares.clear();
+}
+
+void ChangeVote::add(const SquareChange changes[64]) {
+  int first = 0;
+  int second = 1;
+  for (int i = 0; i < 64; i++) {
+    if (top_squares.empty()) {
+      sums[i] = changes[i];
+    } else {
+      sums[i].change += changes[i].change;
+    }
+    if (changes[i].change > changes[first].change) {
+      second = first;
+      first = i;
+    } else if (i != first && changes[i].change > changes[second].change) {
+      second = i;
+    }
+  }
+  top_squares.push_back(std::minmax(changes[first].index, changes[second].index));
+}
+
+int ChangeVote::frames() const {
+  return top_squares.size();
+}
+
+double ChangeVote::result(SquareChange changes[64]) const {
+  for (int i = 0; i < 64; i++) {
+    changes[i] = sums[i];
+    changes[i].change /= top_squares.size();
+  }
+  std::sort(changes, changes + 64, &square_change_sorter);
+  std::pair<int, int> top = std::minmax(changes[0].index, changes[1].index);
+  return (double)std::count(top_squares.begin(), top_squares.end(), top) / top_squares.size();
+}
+
+void match_lighting(const cv::Mat& image, const cv::Mat& lighting, cv::Mat& matched) {
+  // Mean and standard deviation of each square
+  cv::Mat image_float, lighting_float;
+  image.convertTo(image_float, CV_32F);
+  lighting.convertTo(lighting_float, CV_32F);
+  cv::Mat image_mean, image_squares, lighting_mean, lighting_squares;
+  cv::resize(image_float, image_mean, {8, 8}, 0, 0, cv::INTER_AREA);
+  cv::resize(image_float.mul(image_float), image_squares, {8, 8}, 0, 0, cv::INTER_AREA);
+  cv::resize(lighting_float, lighting_mean, {8, 8}, 0, 0, cv::INTER_AREA);
+  cv::resize(lighting_float.mul(lighting_float), lighting_squares, {8, 8}, 0, 0, cv::INTER_AREA);
+  cv::Mat gain(8, 8, CV_32F);
+  for (int i = 0; i < 64; i++) {
+    float image_deviation = std::sqrt(std::max(
+      image_squares.at<float>(i) - image_mean.at<float>(i) * image_mean.at<float>(i), 0.0f));
+    float lighting_deviation = std::sqrt(std::max(
+      lighting_squares.at<float>(i) - lighting_mean.at<float>(i) * lighting_mean.at<float>(i), 0.0f));
+    gain.at<float>(i) = std::max(lighting_deviation, MIN_SQUARE_DEVIATION) /
+      std::max(image_deviation, MIN_SQUARE_DEVIATION);
+  }
+  // Median of neighbouring squares ignores the few squares a move changes
+  cv::medianBlur(gain, gain, 3);
+  cv::Mat offset = lighting_mean - gain.mul(image_mean);
+  cv::medianBlur(offset, offset, 3);
+  cv::resize(gain, gain, image.size(), 0, 0, cv::INTER_LINEAR);
+  cv::resize(offset, offset, image.size(), 0, 0, cv::INTER_LINEAR);
+  cv::Mat adjusted = image_float.mul(gain) + offset;
+  adjusted.convertTo(matched, CV_8U);
+}
+
+void move_difference(const cv::Mat& before, const cv::Mat& after, cv::Mat& diff) {
+  cv::Mat blurred;
+  match_lighting(before, after, diff);
+  cv::absdiff(diff, after, diff);
+  cv::medianBlur(diff, blurred, 5);
+  cv::adaptiveThreshold(blurred, diff, 255, cv::ADAPTIVE_THRESH_MEAN_C, cv::THRESH_BINARY_INV, 5, 2);
+}
+
+static VisionEvent frame_event(VisionEvent::Type type, const Frame& frame) {
+  VisionEvent event;
+  event.type = type;
+  event.timestamp = frame.timestamp;
+  event.frame_sequence = frame.sequence;
+  return event;
+}
+
+static void to_gray(const cv::Mat& image, cv::Mat& gray) {
+  if (image.channels() == 1) {
+    gray = image;
+  } else {
+    cv::cvtColor(image, gray, cv::COLOR_BGR2GRAY);
+  }
+}
+
 VideoCapture::VideoCapture(
     std::function<void()> on_move_start,
-    std::function<std::string(SquareChange[64])> on_move_finish
+    std::function<std::string(FinishedMove&)> on_move_finish,
+    std::function<void()> on_board_not_found
   )
-    : on_move_start(on_move_start), on_move_finish(on_move_finish) {
+    : camera("/dev/video0"), on_move_start(on_move_start), on_move_finish(on_move_finish),
+      on_board_not_found(on_board_not_found),
+      tracker({VIDEO_WIDTH, VIDEO_HEIGHT}), confirmation_frames(CONFIRMATION_FRAMES),
+      scheduler(VIDEO_WIDTH, VIDEO_HEIGHT), analysis_size(ANALYSIS_SIZE) {
 }
 
 void VideoCapture::start() {
   std::thread video_thread(&VideoCapture::capture_frames, this);
   video_thread.detach();
+  std::thread processing_thread(&VideoCapture::process_frames, this);
+  processing_thread.detach();
+}
+
+void VideoCapture::replay(ReplaySource& source) {
+  Frame first;
+  // Board is detected in full resolution frames only
+  do {
+    if (!source.next(first)) {
+      logger::error("Nothing to replay");
+      return;
+    }
+  } while (first.image.size() != cv::Size(VIDEO_WIDTH, VIDEO_HEIGHT));
+  {
+    std::lock_guard<std::mutex> guard(frame_mutex);
+    to_gray(first.image, frame_gray);
+    starting = true;
+  }
+  detect_board_in_background(first.image);
+  std::thread processing_thread(&VideoCapture::process_frames, this);
+  std::uint64_t dropped = 0;
+  Frame skipped;
+  for ( ; ; ) {
+    Frame* slot = source.get_pacing() == ReplaySource::Pacing::Fast
+      ? &frames.wait_acquire() : frames.acquire();
+    if (!source.next(slot == nullptr ? skipped : *slot)) {
+      break;
+    }
+    if (slot == nullptr) {
+      dropped++;
+      dropped_frames++;
+      continue;
+    }
+    frames.publish();
+  }
+  // Empty frame stops processing
+  frames.wait_acquire().image.release();
+  frames.publish();
+  processing_thread.join();
+  logger::info("Replay finished, %llu frames dropped", (unsigned long long)dropped);
 }
 
 static int discover_columns_in_row(
@@ -127,45 +343,94 @@ static int find_square_bellow_known_column(
   return -1;
 }
 
-void VideoCapture::detect_board(cv::Mat& frame, std::string debug_dir) {
-  std::filesystem::remove_all(debug_dir);
-  std::filesystem::create_directories(debug_dir);
+/**
+ * Convex quadrilateral approximating a contour with its sides split into
+ * horizontal and vertical ones. Polygon is empty if contour is not one.
+ */
+class ContourShape {
+ public:
+  cv::Mat polygon;
+  std::vector<Line> horizontal_lines;
+  std::vector<Line> vertical_lines;
+  double center_x, center_y;
+};
+
+/**
+ * Threshold blurred board image, separate cells by erosion and return their
+ * contours. Suffix tells debug images of both threshold types apart.
+ */
+static std::vector<std::vector<cv::Point>> find_cell_contours(const cv::Mat& blurred,
+    int threshold_type, const cv::Mat& element, std::string debug_dir, std::string suffix) {
+  cv::Mat threshold;
+  cv::threshold(blurred, threshold, 0, 255, threshold_type + cv::THRESH_OTSU);
+  debug_images::write(debug_dir + "/start_game_threshold" + suffix + ".jpg", threshold);
+  cv::Mat eroded;
+  cv::erode(threshold, eroded, element);
+  debug_images::write(debug_dir + "/start_game_eroded" + suffix + ".jpg", eroded);
+  std::vector<std::vector<cv::Point>> contours;
+  std::vector<cv::Vec4i> hierarchy;
+  cv::findContours(eroded, contours, hierarchy, cv::RETR_LIST, cv::CHAIN_APPROX_SIMPLE);
+  return contours;
+}
+
+static ContourShape classify_contour(const std::vector<cv::Point>& contour) {
+  ContourShape shape;
+  cv::Rect bounding_box = cv::boundingRect(contour);
+  if (bounding_box.height > VIDEO_HEIGHT / 4) {
+    return shape;  // Reject contours obviously too big to be board cells
+  }
+  cv::Mat approx;
+  approxPolyDP(contour, approx, 10, true);
+  if (approx.size().height != 4 || !cv::isContourConvex(approx)) {
+    return shape;
+  }
+  for (int i = 0; i < 4; i++) {
+    cv::Point pt1 = approx.at<cv::Point>(i, 0);
+    cv::Point pt2 = approx.at<cv::Point>((i + 1) % 4, 0);
+    Line line(pt1, pt2);
+    double angle = std::atan2(pt2.y - pt1.y, pt2.x - pt1.x) * 180.0 / M_PI;
+    if (
+        angle > -5 && angle < 5 ||
+        angle > -185 && angle < -175 ||
+        angle > 175 && angle < 185
+    ) {
+      shape.horizontal_lines.push_back(line);
+    } else {
+      shape.vertical_lines.push_back(line);
+    }
+  }
+  cv::Moments m = cv::moments(contour, false);
+  shape.center_x = m.m10 / m.m00;
+  shape.center_y = m.m01 / m.m00;
+  shape.polygon = approx;
+  return shape;
+}
+
+cv::Mat VideoCapture::detect_board(const cv::Mat& frame, std::string debug_dir) {
+  debug_images::clear_directory(debug_dir);
   std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
-  cv::imwrite(debug_dir + "/start_game_original.jpg", frame);
+  debug_images::write(debug_dir + "/start_game_original.jpg", frame);
   cv::Mat markers;
   frame.copyTo(markers);
   cv::Mat gray;
   cv::cvtColor(frame, gray, cv::COLOR_BGR2GRAY);
-  cv::imwrite(debug_dir + "/start_game_gray.jpg", gray);
+  debug_images::write(debug_dir + "/start_game_gray.jpg", gray);
   cv::Mat blurred;
   cv::medianBlur(gray, blurred, 5);
-  cv::imwrite(debug_dir + "/start_game_blurred.jpg", blurred);
+  debug_images::write(debug_dir + "/start_game_blurred.jpg", blurred);
 
-  cv::Mat threshold;
-  cv::threshold(blurred, threshold, 0, 255, cv::THRESH_BINARY + cv::THRESH_OTSU);
-  cv::imwrite(debug_dir + "/start_game_threshold.jpg", threshold);
-  cv::Mat threshold_inverted;
-  cv::threshold(blurred, threshold_inverted, 0, 255, cv::THRESH_BINARY_INV + cv::THRESH_OTSU);
-  cv::imwrite(debug_dir + "/start_game_threshold_inverted.jpg", threshold_inverted);
-
-  cv::Mat eroded;
   int erosion_size = 3;
   cv::Mat element = getStructuringElement(
     cv::MORPH_RECT,
     cv::Size(2 * erosion_size + 1, 2 * erosion_size + 1),
     cv::Point(erosion_size, erosion_size));
-  cv::erode(threshold, eroded, element);
-  cv::imwrite(debug_dir + "/start_game_eroded.jpg", eroded);
-  cv::Mat eroded_inverted;
-  cv::erode(threshold_inverted, eroded_inverted, element);
-  cv::imwrite(debug_dir + "/start_game_eroded_inverted.jpg", eroded_inverted);
-
-  std::vector<std::vector<cv::Point>> contours;
-  std::vector<std::vector<cv::Point>> contours_inverted;
-  std::vector<cv::Vec4i> hierarchy;
-
-  cv::findContours(eroded, contours, hierarchy, cv::RETR_LIST, cv::CHAIN_APPROX_SIMPLE);
-  cv::findContours(eroded_inverted, contours_inverted, hierarchy, cv::RETR_LIST, cv::CHAIN_APPROX_SIMPLE);
+  // Dark and light squares are found in separate images
+  std::future<std::vector<std::vector<cv::Point>>> inverted = std::async(std::launch::async,
+    find_cell_contours, std::cref(blurred), cv::THRESH_BINARY_INV, std::cref(element),
+    debug_dir, "_inverted");
+  std::vector<std::vector<cv::Point>> contours = find_cell_contours(
+    blurred, cv::THRESH_BINARY, element, debug_dir, "");
+  std::vector<std::vector<cv::Point>> contours_inverted = inverted.get();
   contours.insert(
     contours.end(),
     std::make_move_iterator(contours_inverted.begin()),
@@ -173,7 +438,14 @@ void VideoCapture::detect_board(cv::Mat& frame, std::string debug_dir) {
   cv::Mat img_contours;
   frame.copyTo(img_contours);
   cv::drawContours(img_contours, contours, -1, {0, 0, 255}, 1, cv::LINE_AA);
-  cv::imwrite(debug_dir + "/start_game_contours.jpg", img_contours);
+  debug_images::write(debug_dir + "/start_game_contours.jpg", img_contours);
+
+  std::vector<ContourShape> shapes(contours.size());
+  cv::parallel_for_(cv::Range(0, contours.size()), [&](const cv::Range& range) {
+    for (int i = range.start; i < range.end; i++) {
+      shapes[i] = classify_contour(contours[i]);
+    }
+  });
 
   cv::Mat img_polygons;
   frame.copyTo(img_polygons);
@@ -184,62 +456,42 @@ void VideoCapture::detect_board(cv::Mat& frame, std::string debug_dir) {
   std::optional<Line> bottommost_line;
   std::optional<Line> leftmost_line;
   std::optional<Line> rightmost_line;
-  for (auto & contour : contours) {
-    cv::Rect bounding_box = cv::boundingRect(contour);
-    if (bounding_box.height > VIDEO_HEIGHT / 4) {
-      continue;  // Reject contours obviously too big to be board cells
-    }
-    cv::Mat approx;
-    approxPolyDP(contour, approx, 10, true);
-    if (approx.size().height == 4 && cv::isContourConvex(approx)) {
-      std::vector<Line> horizontal_lines;
-      std::vector<Line> vertical_lines;
-      for (int i = 0; i < 4; i++) {
-        cv::Point pt1 = approx.at<cv::Point>(i, 0);
-        cv::Point pt2 = approx.at<cv::Point>((i + 1) % 4, 0);
-        Line line(pt1, pt2);
-        double angle = std::atan2(pt2.y - pt1.y, pt2.x - pt1.x) * 180.0 / M_PI;
-        if (
-            angle > -5 && angle < 5 ||
-            angle > -185 && angle < -175 ||
-            angle > 175 && angle < 185
-        ) {
-          horizontal_lines.push_back(line);
-        } else {
-          vertical_lines.push_back(line);
-        }
+  // Merge in contour order so results don't depend on scheduling
+  for (auto & shape : shapes) {
+    if (shape.polygon.empty()) {
+      continue;
+    }
+    std::vector<Line>& horizontal_lines = shape.horizontal_lines;
+    std::vector<Line>& vertical_lines = shape.vertical_lines;
+    if (horizontal_lines.size() == 2) {
+      std::sort(horizontal_lines.begin(), horizontal_lines.end(), line_top);
+      if (!topmost_line || !line_top.operator()(topmost_line.value(), horizontal_lines[0])) {
+        topmost_line = horizontal_lines[0];
       }
-      if (horizontal_lines.size() == 2) {
-        std::sort(horizontal_lines.begin(), horizontal_lines.end(), line_top);
-        if (!topmost_line || !line_top.operator()(topmost_line.value(), horizontal_lines[0])) {
-          topmost_line = horizontal_lines[0];
-        }
-        std::sort(horizontal_lines.begin(), horizontal_lines.end(), line_bottom);
-        if (!bottommost_line || line_bottom.operator()(bottommost_line.value(), horizontal_lines[1])) {
-          bottommost_line = horizontal_lines[1];
-        }
-        std::sort(vertical_lines.begin(), vertical_lines.end(), line_left);
-        if (!leftmost_line || !line_left.operator()(leftmost_line.value(), vertical_lines[0])) {
-          leftmost_line = vertical_lines[0];
-        }
-        std::sort(vertical_lines.begin(), vertical_lines.end(), line_right);
-        if (!rightmost_line || line_right.operator()(rightmost_line.value(), vertical_lines[1])) {
-          rightmost_line = vertical_lines[1];
-        }
-        cv::polylines(markers, approx, true, {0, 255, 0}, 1, cv::LINE_AA);
-        cv::Moments m = cv::moments(contour, false);
-        squares.push_back({
-          approx,
-          m.m10 / m.m00,
-          m.m01 / m.m00,
-          horizontal_lines[0],
-          horizontal_lines[1],
-          vertical_lines[0],
-          vertical_lines[1]
-        });
-      } else {
-        rejected_polygons.push_back(approx);
+      std::sort(horizontal_lines.begin(), horizontal_lines.end(), line_bottom);
+      if (!bottommost_line || line_bottom.operator()(bottommost_line.value(), horizontal_lines[1])) {
+        bottommost_line = horizontal_lines[1];
+      }
+      std::sort(vertical_lines.begin(), vertical_lines.end(), line_left);
+      if (!leftmost_line || !line_left.operator()(leftmost_line.value(), vertical_lines[0])) {
+        leftmost_line = vertical_lines[0];
+      }
+      std::sort(vertical_lines.begin(), vertical_lines.end(), line_right);
+      if (!rightmost_line || line_right.operator()(rightmost_line.value(), vertical_lines[1])) {
+        rightmost_line = vertical_lines[1];
       }
+      cv::polylines(markers, shape.polygon, true, {0, 255, 0}, 1, cv::LINE_AA);
+      squares.push_back({
+        shape.polygon,
+        shape.center_x,
+        shape.center_y,
+        horizontal_lines[0],
+        horizontal_lines[1],
+        vertical_lines[0],
+        vertical_lines[1]
+      });
+    } else {
+      rejected_polygons.push_back(shape.polygon);
     }
   }
 
@@ -431,7 +683,7 @@ void VideoCapture::detect_board(cv::Mat& frame, std::string debug_dir) {
   for (auto & polygon : rejected_polygons) {
     cv::polylines(img_polygons, {polygon}, true, {0, 0, 255}, 1, cv::LINE_AA);
   }
-  cv::imwrite(debug_dir + "/start_game_polygons.jpg", img_polygons);
+  debug_images::write(debug_dir + "/start_game_polygons.jpg", img_polygons);
 
   cv::Point bottom_left_point = line_intersection(leftmost_line.value(), bottommost_line.value());
   cv::circle(markers, bottom_left_point, 8, {0, 0, 255}, -1);
@@ -464,7 +716,7 @@ void VideoCapture::detect_board(cv::Mat& frame, std::string debug_dir) {
     top_right_point.y - distance_top_y / 2);
   cv::circle(markers, final_top_right_point, 8, {255, 0, 255}, -1);
 
-  cv::imwrite(debug_dir + "/start_game_markers.jpg", markers);
+  debug_images::write(debug_dir + "/start_game_markers.jpg", markers);
 
   std::vector<cv::Point2f> points_from({
     final_bottom_left_point,
@@ -478,51 +730,227 @@ void VideoCapture::detect_board(cv::Mat& frame, std::string debug_dir) {
     {VIDEO_HEIGHT, 0.0f},
     {VIDEO_HEIGHT, VIDEO_HEIGHT}
   });
-  perspective_transform = cv::getPerspectiveTransform(points_from, points_to);
+  cv::Mat transform = cv::getPerspectiveTransform(points_from, points_to);
 
-  cv::warpPerspective(
-      frame, img_perspective, perspective_transform,
-      {VIDEO_HEIGHT, VIDEO_HEIGHT}
-  );
-  cv::imwrite(debug_dir + "/start_game_perspective.jpg", img_perspective);
+  cv::Mat perspective;
+  cv::warpPerspective(frame, perspective, transform, {VIDEO_HEIGHT, VIDEO_HEIGHT});
+  debug_images::write(debug_dir + "/start_game_perspective.jpg", perspective);
   std::chrono::steady_clock::time_point end_time = std::chrono::steady_clock::now();
   logger::info("Detected chess board in %dms",
     (int)std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time).count());
+  return transform;
 }
 
-void VideoCapture::start_game() {
-  std::lock_guard<std::mutex> guard(frame_mutex);
+void VideoCapture::detect_board_in_background(cv::Mat snapshot) {
+  cv::Mat gray;
+  to_gray(snapshot, gray);
+  std::shared_ptr<Board> board;
+  if (!calibration_directory.empty()) {
+    board = load_calibration(calibration_directory, gray.size());
+    if (board) {
+      double match = calibration_match(*board, gray);
+      if (match >= MIN_CALIBRATION_MATCH) {
+        logger::info("Using saved board calibration, match %.2f", match);
+        // Debug images are of the last game only, as when board is detected
+        debug_images::clear_directory("debug");
+      } else {
+        logger::info("Saved board calibration doesn't match, %.2f", match);
+        board = nullptr;
+      }
+    }
+  }
+  bool detected = !board;
+  if (detected) {
+    board = std::make_shared<Board>();
+    try {
+      board->perspective_transform = detect_board(snapshot, "debug");
+    } catch (const std::exception& e) {
+      logger::error("Failed to detect chess board: %s", e.what());
+      debug_images::write("debug/start_game_failed.jpg", snapshot, true);
+      {
+        std::lock_guard<std::mutex> guard(frame_mutex);
+        starting = false;
+      }
+      if (on_board_not_found) {
+        on_board_not_found();
+      }
+      return;
+    }
+  }
+  // Pieces and lighting are as they are now, not as when calibrated
+  cv::warpPerspective(gray, board->reference, board->perspective_transform,
+    {VIDEO_HEIGHT, VIDEO_HEIGHT});
+  board->gray = gray;
+  if (detected && !calibration_directory.empty()) {
+    save_calibration(calibration_directory, *board);
+  }
+  detected_board.store(board);
+}
 
-  detect_board(frame, "debug");
+void VideoCapture::set_transform(const cv::Mat& transform) {
+  transform.copyTo(perspective_transform);
+  // Rebuild warp tables on the next warp
+  warp_frame_size = cv::Size();
+}
 
-  cv::cvtColor(img_perspective, last_move, cv::COLOR_BGR2GRAY);
+bool VideoCapture::track_board(const Frame& captured) {
+  std::optional<cv::Mat> transform = tracker.track(captured_gray);
+  if (!tracker.found() && !board_lost) {
+    vision_events.publish(frame_event(VisionEvent::Type::BoardLost, captured));
+  }
+  board_lost = !tracker.found();
+  if (!transform) {
+    return false;
+  }
+  set_transform(transform.value());
+  build_pyramid(captured_gray);
+  return true;
+}
 
-  bg_sub = cv::createBackgroundSubtractorMOG2(500, 32, true);
-  // Ensure that there are no changes in the inital frames
-  cv::Mat mask;
-  bg_sub->apply(img_perspective, mask, 1);
+void VideoCapture::prepare_warp(cv::Size frame_size) {
+  // Centres of analysis image pixels in full size top down view
+  float scale = (float)VIDEO_HEIGHT / analysis_size;
+  cv::Mat destination(analysis_size, analysis_size, CV_32FC2);
+  for (int y = 0; y < analysis_size; y++) {
+    cv::Vec2f* row = destination.ptr<cv::Vec2f>(y);
+    for (int x = 0; x < analysis_size; x++) {
+      row[x] = cv::Vec2f((x + 0.5f) * scale - 0.5f, (y + 0.5f) * scale - 0.5f);
+    }
+  }
+  cv::Mat source;
+  cv::perspectiveTransform(destination, source, perspective_transform.inv());
+  // Perspective transform was detected in a full resolution frame
+  if (frame_size != cv::Size(VIDEO_WIDTH, VIDEO_HEIGHT)) {
+    cv::multiply(source, cv::Scalar(
+      (double)frame_size.width / VIDEO_WIDTH, (double)frame_size.height / VIDEO_HEIGHT
+    ), source);
+  }
+  cv::convertMaps(source, cv::noArray(), warp_map1, warp_map2, CV_16SC2);
+  warp_frame_size = frame_size;
+}
+
+void VideoCapture::warp(const cv::Mat& image, cv::Mat& warped) {
+  if (image.size() != warp_frame_size) {
+    prepare_warp(image.size());
+  }
+  cv::remap(image, warped, warp_map1, warp_map2, cv::INTER_LINEAR);
+}
+
+void VideoCapture::build_pyramid(const cv::Mat& gray) {
+  warp(gray, gray_perspective);
+  // Motion detector downsamples further anyway
+  cv::pyrDown(gray_perspective, motion_perspective);
+}
+
+void VideoCapture::reset_reference(const cv::Mat& board) {
+  board.copyTo(last_move);
+  board.convertTo(move_reference, CV_32F);
+}
+
+void VideoCapture::set_analysis_size(int size) {
+  size = std::clamp(size / 16 * 16, 128, VIDEO_HEIGHT);
+  std::lock_guard<std::mutex> guard(frame_mutex);
+  if (size == analysis_size) {
+    return;
+  }
+  logger::info("Analysing %dx%d board images", size, size);
+  analysis_size = size;
+  // Rebuild warp tables on the next warp
+  warp_frame_size = cv::Size();
+  // Game in progress continues at the new size
+  if (!last_move.empty()) {
+    cv::resize(last_move, last_move, {size, size}, 0, 0, cv::INTER_AREA);
+    last_move.convertTo(move_reference, CV_32F);
+    cv::resize(gray_perspective, gray_perspective, {size, size}, 0, 0, cv::INTER_AREA);
+    cv::pyrDown(gray_perspective, motion_perspective);
+    motion.reset(motion_perspective);
+    vote.clear();
+  }
+}
 
-  ply_index = 1;
+void VideoCapture::start_game() {
+  std::lock_guard<std::mutex> guard(frame_mutex);
+  // Processing thread takes the next frame, frame kept from the last one
+  // is stale while playing
+  starting = true;
+  detection_requested = true;
+  // Game in progress could be idle at reduced resolution, board is
+  // detected in full resolution frames
+  playing = false;
+  scheduler.set_playing(false);
 }
 
 void VideoCapture::resume_game() {
   std::lock_guard<std::mutex> guard(frame_mutex);
-  cv::warpPerspective(
-      frame, img_perspective, perspective_transform,
-      {VIDEO_HEIGHT, VIDEO_HEIGHT}
-  );
-  bg_sub = cv::createBackgroundSubtractorMOG2(500, 32, true);
+  // Board could have been moved while game was stopped
+  if (std::optional<cv::Mat> transform = tracker.track(frame_gray)) {
+    set_transform(transform.value());
+  }
+  build_pyramid(frame_gray);
   // Ensure that there are no changes in the inital frames
-  cv::Mat mask;
-  bg_sub->apply(img_perspective, mask, 1);
+  motion.reset(motion_perspective);
+  playing = true;
+  scheduler.set_playing(true);
 }
 
 void VideoCapture::stop_game() {
   std::lock_guard<std::mutex> guard(frame_mutex);
-  bg_sub.reset();
+  starting = false;
+  detection_requested = false;
+  playing = false;
+  scheduler.set_playing(false);
 }
 
 void VideoCapture::capture_frames() {
+  if (!capture_v4l2_frames()) {
+    logger::warn("Falling back to OpenCV camera capture");
+    capture_opencv_frames();
+  }
+}
+
+bool VideoCapture::capture_v4l2_frames() {
+  FrameScheduler::Mode mode = scheduler.mode();
+  if (!camera.open(mode.width, mode.height)) {
+    return false;
+  }
+  std::chrono::steady_clock::time_point next_frame = std::chrono::steady_clock::now();
+  std::uint64_t dropped = 0;
+  Frame skipped;
+  for ( ; ; ) {
+    FrameScheduler::Mode next_mode = scheduler.mode();
+    if (next_mode.width != mode.width || next_mode.height != mode.height) {
+      logger::info("Switching camera to %dx%d", next_mode.width, next_mode.height);
+      camera.close();
+      if (!camera.open(next_mode.width, next_mode.height)) {
+        logger::error("Failed to reopen camera at %dx%d", next_mode.width, next_mode.height);
+        return false;
+      }
+    }
+    mode = next_mode;
+    Frame* slot = frames.acquire();
+    Frame& frame = slot == nullptr ? skipped : *slot;
+    if (!camera.grab(frame)) {
+      std::this_thread::sleep_for(CAPTURE_RETRY_INTERVAL);
+      continue;
+    }
+    if (frame.timestamp < next_frame) {
+      camera.release(frame.buffer);
+      continue;
+    }
+    if (slot == nullptr) {
+      camera.release(frame.buffer);
+      dropped_frames++;
+      if (dropped++ % 100 == 0) {
+        logger::warn("Dropped %llu frames as processing is too slow", (unsigned long long)dropped);
+      }
+      continue;
+    }
+    next_frame = frame.timestamp + mode.interval;
+    frames.publish();
+  }
+}
+
+void VideoCapture::capture_opencv_frames() {
   cv::VideoCapture cap;
   int deviceID = 0;  // 0 = open default camera
   cap.open(deviceID, cv::CAP_V4L2);
@@ -530,117 +958,273 @@ void VideoCapture::capture_frames() {
     logger::error("Failed to open camera");
     return;
   }
-  cap.set(cv::CAP_PROP_FRAME_WIDTH, VIDEO_WIDTH);
-  cap.set(cv::CAP_PROP_FRAME_HEIGHT, VIDEO_HEIGHT);
-  for (; ; ) {
-    frame_mutex.lock();
-    for ( ; ; ) {
-      cap.read(frame);
-      cv::Mat laplacian;
-      cv::Laplacian(frame, laplacian, CV_64F);
-      cv::Scalar mean, stddev;
-      cv::meanStdDev(laplacian, mean, stddev);
-      double variance = stddev.val[0] * stddev.val[0];
-      if (variance < 80) {
-        cv::imwrite("debug/blurry.jpg", frame);
-        logger::info("Rejecting blurry image with variance: %f", variance);
-      } else {
-        break;
+  FrameScheduler::Mode mode = scheduler.mode();
+  cap.set(cv::CAP_PROP_FRAME_WIDTH, mode.width);
+  cap.set(cv::CAP_PROP_FRAME_HEIGHT, mode.height);
+  std::chrono::steady_clock::time_point next_frame = std::chrono::steady_clock::now();
+  std::uint64_t sequence = 0;
+  std::uint64_t dropped = 0;
+  std::uint64_t failed = 0;
+  for ( ; ; ) {
+    FrameScheduler::Mode next_mode = scheduler.mode();
+    if (next_mode.width != mode.width || next_mode.height != mode.height) {
+      logger::info("Switching camera to %dx%d", next_mode.width, next_mode.height);
+      cap.set(cv::CAP_PROP_FRAME_WIDTH, next_mode.width);
+      cap.set(cv::CAP_PROP_FRAME_HEIGHT, next_mode.height);
+    }
+    mode = next_mode;
+    // Grabbing without retrieving doesn't decode the frame
+    if (!cap.grab()) {
+      if (failed++ % 100 == 0) {
+        logger::warn("Failed to grab frame %llu times", (unsigned long long)failed);
       }
+      std::this_thread::sleep_for(CAPTURE_RETRY_INTERVAL);
+      continue;
     }
-    if (!bg_sub.empty()) {
-      cv::warpPerspective(
-          frame, img_perspective, perspective_transform,
-          {VIDEO_HEIGHT, VIDEO_HEIGHT}
-      );
-      cv::Mat mask;
-      bg_sub->apply(img_perspective, mask, -1);
-      double total_changes = cv::sum(mask).dot(cv::Scalar::ones());
-      //logger::debug("Background subtraction change: %f", total_changes);
-      if (moving) {
-        if (total_changes < 1500000) {
-          moving = false;
-
-          cv::Mat gray_perspective;
-          cv::cvtColor(img_perspective, gray_perspective, cv::COLOR_BGR2GRAY);
-          cv::Mat diff;
-          cv::absdiff(last_move, gray_perspective, diff);
-          cv::Mat blurred;
-          cv::medianBlur(diff, blurred, 5);
-          cv::adaptiveThreshold(blurred, diff, 255, cv::ADAPTIVE_THRESH_MEAN_C, cv::THRESH_BINARY_INV, 5, 2);
-          cv::Mat without_cell_boundaries = cv::Mat::zeros(
-            cv::Size(VIDEO_HEIGHT, VIDEO_HEIGHT), diff.type());
-          int square_size = VIDEO_HEIGHT / 8;
-          int margin = 10;
-          for (int x = 0; x < 8; x++) {
-            for (int y = 0; y < 8; y++) {
-              cv::Rect cell = cv::Rect(
-                x * square_size + margin / 2, y * square_size + margin / 2,
-                square_size - margin, square_size - margin);
-              diff(cell).copyTo(without_cell_boundaries(cell));
-            }
-          }
-          without_cell_boundaries.copyTo(diff);
-
-          SquareChange changes[64];
-          for (int x = 0; x < 8; x++) {
-            for (int y = 0; y < 8; y++) {
-              cv::Mat square = diff(cv::Rect(x * square_size, y * square_size, square_size, square_size));
-              double sum = cv::sum(square).dot(cv::Scalar::ones());
-              changes[y * 8 + x] = {x, y, (7 - x) * 8 + (7 - y), sum};
-            }
-          }
-          std::sort(changes, changes + 64, &square_change_sorter);
+    sequence++;
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (now < next_frame) {
+      continue;
+    }
+    next_frame = now + mode.interval;
+    Frame* slot = frames.acquire();
+    if (slot == nullptr) {
+      dropped_frames++;
+      if (dropped++ % 100 == 0) {
+        logger::warn("Dropped %llu frames as processing is too slow", (unsigned long long)dropped);
+      }
+      continue;
+    }
+    cap.retrieve(slot->image);
+    slot->timestamp = now;
+    slot->sequence = sequence;
+    if (slot->image.empty()) {
+      logger::warn("Blank frame grabbed");
+      continue;
+    }
+    frames.publish();
+  }
+}
 
-          cv::Mat colored;
-          cv::cvtColor(diff, colored, cv::COLOR_GRAY2BGR);
+void VideoCapture::release_frame(Frame& frame) {
+  if (frame.buffer != -1) {
+    // Images point into camera buffer which is about to be reused
+    frame.image.release();
+    captured_gray.release();
+    camera.release(frame.buffer);
+    frame.buffer = -1;
+  }
+  frames.release();
+}
 
-          for (int j = 0; j < 6; j++) {
-            SquareChange change = changes[j];
-            cv::rectangle(colored,
-              {change.x * square_size, change.y * square_size},
-              {change.x * square_size + square_size, change.y * square_size + square_size},
-              {0, 0, 255}, 1, cv::LINE_AA);
-          }
+double VideoCapture::sharpness(const cv::Mat& image) {
+  // Sample every other pixel, unlike averaging it keeps edges sharp
+  cv::resize(image, sharpness_sample, {}, 0.5, 0.5, cv::INTER_NEAREST);
+  cv::Mat gray = sharpness_sample;
+  if (sharpness_sample.channels() == 3) {
+    cv::cvtColor(sharpness_sample, sharpness_gray, cv::COLOR_BGR2GRAY);
+    gray = sharpness_gray;
+  }
+  cv::Laplacian(gray, sharpness_laplacian, CV_16S);
+  cv::Scalar mean, stddev;
+  cv::meanStdDev(sharpness_laplacian, mean, stddev);
+  return stddev.val[0] * stddev.val[0];
+}
 
-          std::string move = on_move_finish(changes);
-          std::string move_number = std::to_string(ply_index);
-          move_number.insert(move_number.begin(), 3 - move_number.size(), '0');
-          if (!move.empty()) {
-            save_differences(img_perspective, colored,
-              "debug/move" + move_number + "-" + move + ".jpg");
-            last_move = img_perspective.clone();
-            cv::cvtColor(img_perspective, last_move, cv::COLOR_BGR2GRAY);
-            if (move == "take back") {
-              ply_index--;
-            } else {
-              ply_index++;
-            }
-          } else {
-            save_differences(img_perspective, colored,
-              "debug/move" + move_number + "-failed.jpg");
-          }
+void VideoCapture::process_frames() {
+  for ( ; ; ) {
+    Frame& captured = frames.consume();
+    if (captured.image.empty()) {
+      frames.release();
+      return;
+    }
+    std::uint64_t dropped = dropped_frames.load(std::memory_order_relaxed);
+    if (dropped != reported_dropped_frames) {
+      VisionEvent event = frame_event(VisionEvent::Type::FrameDropped, captured);
+      event.dropped = dropped - reported_dropped_frames;
+      vision_events.publish(event);
+      reported_dropped_frames = dropped;
+    }
+    frame_to_gray(captured, captured_gray);
+    double variance = sharpness(captured_gray);
+    if (variance < 600) {
+      debug_images::write("debug/blurry.jpg", captured_gray);
+      logger::info("Rejecting blurry image with variance: %f", variance);
+      release_frame(captured);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(frame_mutex);
+    if (detection_requested && captured_gray.size() == cv::Size(VIDEO_WIDTH, VIDEO_HEIGHT)) {
+      detection_requested = false;
+      cv::Mat snapshot;
+      frame_to_bgr(captured, snapshot);
+      // Frames keep being processed while board is detected
+      std::thread detection_thread(&VideoCapture::detect_board_in_background, this, snapshot);
+      detection_thread.detach();
+    }
+    std::shared_ptr<const Board> detected = detected_board.load();
+    if (starting && detected != board) {
+      board = detected;
+      set_transform(board->perspective_transform);
+      tracker.reset(board->gray, perspective_transform);
+      last_tracked = captured.timestamp;
+      // Moves made while board was being detected are compared to the
+      // initial position
+      cv::Mat reference;
+      cv::resize(board->reference, reference, {analysis_size, analysis_size}, 0, 0, cv::INTER_AREA);
+      reset_reference(reference);
+      cv::pyrDown(reference, motion_perspective);
+      motion.reset(motion_perspective);
+      starting = false;
+      playing = true;
+      scheduler.set_playing(true);
+      ply_index = 1;
+    }
+    if (!playing) {
+      // Keep grayscale frame for resume_game
+      if (captured_gray.datastart == captured.image.datastart) {
+        // Luma plane is a view of the buffer going back to the camera
+        captured_gray.copyTo(frame_gray);
+      } else {
+        cv::swap(frame_gray, captured_gray);
+      }
+      release_frame(captured);
+      continue;
+    }
+    build_pyramid(captured_gray);
+    Motion state = motion.update(motion_perspective);
+    if (motion.moving()) {
+      scheduler.motion();
+    }
+    if (motion.still() == 1 && vote.frames() == 0) {
+      hand_left = captured.timestamp;
+    }
+    if (state == Motion::Started) {
+      // Hand came back before the move was confirmed
+      vote.clear();
+      vision_events.publish(frame_event(VisionEvent::Type::MotionStart, captured));
+      on_move_start();
+    } else if (state == Motion::Finished || vote.frames() > 0) {
+      if (state == Motion::Finished) {
+        vision_events.publish(frame_event(VisionEvent::Type::MotionEnd, captured));
+        // Hand could have bumped the board or camera
+        track_board(captured);
+        // Moved pieces are background now, otherwise a move changing many
+        // squares, like castling or capture, starts motion again
+        motion.reset(motion_perspective);
+      }
+      cv::Mat diff;
+      move_difference(last_move, gray_perspective, diff);
+      SquareChange changes[64];
+      square_changes(diff, analysis_size / 48, changes);
+      vote.add(changes);
+      VisionEvent scores = frame_event(VisionEvent::Type::SquareScores, captured);
+      for (const SquareChange& change : changes) {
+        scores.scores[change.index] = change.change;
+      }
+      vision_events.publish(scores);
+      if (vote.frames() >= confirmation_frames) {
+        finish_move(captured, diff, lock);
+      }
+    } else if (state == Motion::None && !motion.moving()) {
+      if (captured.timestamp - last_tracked >= TRACK_INTERVAL) {
+        last_tracked = captured.timestamp;
+        if (track_board(captured)) {
+          // Background learned from misaligned frames is useless
+          motion.reset(motion_perspective);
+          // Nothing moved since the last move, only the board
+          reset_reference(gray_perspective);
         }
-      } else if (total_changes > 2000000) {
-        moving = true;
-        on_move_start();
+      }
+      if (motion.still() > 0) {
+        // Follow slow lighting changes so they don't accumulate until the
+        // next move
+        cv::accumulateWeighted(gray_perspective, move_reference, REFERENCE_LEARNING_RATE);
+        move_reference.convertTo(last_move, CV_8U);
       }
     }
-    frame_mutex.unlock();
-    if (frame.empty()) {
-      logger::warn("Blank frame grabbed");
+    release_frame(captured);
+  }
+}
+
+void VideoCapture::finish_move(Frame& captured, const cv::Mat& diff,
+    std::unique_lock<std::mutex>& lock) {
+  FinishedMove finished;
+  finished.confidence = vote.result(finished.changes);
+  // Copies, the game can be resumed or resized while callback runs
+  finished.before = last_move.clone();
+  finished.after = gray_perspective.clone();
+  finished.timestamp = hand_left;
+  vote.clear();
+
+  // Recognising the move is slow, capture and game control don't wait for it
+  lock.unlock();
+  std::string move = on_move_finish(finished);
+  lock.lock();
+  std::string move_number = std::to_string(ply_index);
+  move_number.insert(move_number.begin(), 3 - move_number.size(), '0');
+  if (!move.empty()) {
+    save_differences(captured, diff, finished.changes,
+      "debug/move" + move_number + "-" + move + ".jpg");
+    if (move == "take back") {
+      ply_index--;
+    } else {
+      ply_index++;
     }
-    // Increase chance for start_game to get the lock
-    std::this_thread::sleep_for(1ms);
+  } else {
+    save_differences(captured, diff, finished.changes,
+      "debug/move" + move_number + "-failed.jpg", true);
   }
+  reset_reference(gray_perspective);
+  motion.reset(motion_perspective);
+  // Corners of squares hidden by moved pieces are not tracked anymore
+  tracker.reset(captured_gray, perspective_transform);
+  last_tracked = captured.timestamp;
+  scheduler.move_finished();
 }
 
-void VideoCapture::save_differences(cv::Mat& img_perspective, cv::Mat& colored, std::string file_name) {
+VideoCapture::~VideoCapture() {
+  vision_events.close();
+}
+
+VisionEvents& VideoCapture::events() {
+  return vision_events;
+}
+
+void VideoCapture::set_calibration_directory(std::string directory) {
+  calibration_directory = directory;
+}
+
+void VideoCapture::set_confirmation_frames(int frames) {
+  confirmation_frames = std::max(frames, 1);
+}
+
+void VideoCapture::save_differences(const Frame& captured, const cv::Mat& diff,
+    const SquareChange changes[64], std::string file_name, bool failure) {
+  // Nothing to convert and warp if the image won't be written anyway
+  if (!debug_images::enabled(failure)) {
+    return;
+  }
+  int square_size = diff.cols / 8;
+  cv::Mat colored;
+  cv::cvtColor(diff, colored, cv::COLOR_GRAY2BGR);
+  for (int j = 0; j < 6; j++) {
+    SquareChange change = changes[j];
+    cv::rectangle(colored,
+      {change.x * square_size, change.y * square_size},
+      {change.x * square_size + square_size, change.y * square_size + square_size},
+      {0, 0, 255}, 1, cv::LINE_AA);
+  }
+  frame_to_bgr(captured, frame);
+  warp(frame, img_perspective);
+  if (img_perspective.size() != colored.size()) {
+    // Analysis size was changed while the move was recognised
+    cv::resize(colored, colored, img_perspective.size(), 0, 0, cv::INTER_NEAREST);
+  }
   cv::Mat bg_sub;
   cv::Mat images[] = {
     img_perspective, colored
   };
   cv::hconcat(images, 2, bg_sub);
-  cv::imwrite(file_name, bg_sub);
-  cv::cvtColor(img_perspective, last_move, cv::COLOR_BGR2GRAY);
+  debug_images::write(file_name, bg_sub, failure);
 }
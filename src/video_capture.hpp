@@ -1,9 +1,22 @@
 #ifndef VIDEO_CAPTURE_H_
 #define VIDEO_CAPTURE_H_
 
+#include "board_tracker.hpp"
+#include "frame_scheduler.hpp"
+#include "motion_detector.hpp"
+#include "replay_source.hpp"
+#include "spscq.hpp"
+#include "v4l2_camera.hpp"
+#include "vision_events.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <functional>
+#include <memory>
 #include <mutex>
 #include <opencv2/opencv.hpp>
+#include <utility>
+#include <vector>
 
 typedef std::pair<cv::Point, cv::Point> Line;
 
@@ -18,20 +31,137 @@ class SquareChange {
   double change;
 };
 
+/**
+ * Sum pixel values of each of 64 squares of the board image in a single pass.
+ * Given margin (in pixels) around square boundaries is ignored.
+ */
+void square_changes(const cv::Mat& diff, int margin, SquareChange changes[64]);
+
+/**
+ * Combines square changes of several still frames after a move so that a
+ * single frame with a shadow or a hand just leaving doesn't decide the move.
+ */
+class ChangeVote {
+ public:
+  void clear();
+
+  /**
+   * Add changes of a frame as computed by square_changes.
+   */
+  void add(const SquareChange changes[64]);
+
+  /**
+   * Number of frames added since clear.
+   */
+  int frames() const;
+
+  /**
+   * Average changes sorted by amount, most changed first. Returns fraction
+   * of frames agreeing with the result on the two most changed squares.
+   */
+  double result(SquareChange changes[64]) const;
+
+ private:
+  SquareChange sums[64];
+  std::vector<std::pair<int, int>> top_squares;
+};
+
+/**
+ * Move seen by the camera.
+ */
+class FinishedMove {
+ public:
+  /**
+   * Changes of squares sorted by amount, most changed first.
+   */
+  SquareChange changes[64];
+
+  /**
+   * Top down grayscale board images before and after the move.
+   */
+  cv::Mat before;
+  cv::Mat after;
+
+  /**
+   * Fraction of confirmation frames agreeing on the most changed squares.
+   */
+  double confidence;
+
+  /**
+   * Capture time of the first frame after the hand left the board.
+   */
+  std::chrono::steady_clock::time_point timestamp;
+};
+
+/**
+ * Adjust brightness and contrast of each square of top down board image so
+ * that it matches lighting of another board image. Lighting is estimated
+ * from the neighbourhood of each square, so pieces moved between the images
+ * are not adjusted away.
+ */
+void match_lighting(const cv::Mat& image, const cv::Mat& lighting, cv::Mat& matched);
+
+/**
+ * Binary image of pixels that differ between two top down board images,
+ * ignoring changes of lighting.
+ */
+void move_difference(const cv::Mat& before, const cv::Mat& after, cv::Mat& diff);
+
+/**
+ * Board found by detect_board.
+ */
+class Board {
+ public:
+  cv::Mat perspective_transform;
+
+  /**
+   * Top down grayscale view of the board with pieces on their initial
+   * squares.
+   */
+  cv::Mat reference;
+
+  /**
+   * Grayscale camera frame in which board was detected.
+   */
+  cv::Mat gray;
+};
+
 class VideoCapture {
  public:
+  /**
+   * on_move_finish returns move recognised from what camera saw or empty
+   * string. on_board_not_found is called if game can't start because board
+   * detection failed.
+   */
   VideoCapture(
     std::function<void()> on_move_start,
-    std::function<std::string(SquareChange[64])> on_move_finish
+    std::function<std::string(FinishedMove&)> on_move_finish,
+    std::function<void()> on_board_not_found = nullptr
   );
 
+  /**
+   * Wakes up subscribers of events, the stream ends with it.
+   */
+  ~VideoCapture();
+
   void start();
 
-  void detect_board(cv::Mat& frame, std::string debug_dir);
+  /**
+   * Process recorded frames instead of camera until they run out. Game is
+   * started on the first full resolution frame.
+   */
+  void replay(ReplaySource& source);
+
+  /**
+   * Find the board in the frame and return perspective transform to its top
+   * down view.
+   */
+  cv::Mat detect_board(const cv::Mat& frame, std::string debug_dir);
 
   /**
    * Called when game starts. Assumption is that all pieces are on their
-   * initial squares.
+   * initial squares. Board is detected in the background, moves are watched
+   * once it is found.
    */
   void start_game();
 
@@ -45,20 +175,176 @@ class VideoCapture {
    */
   void stop_game();
 
+  /**
+   * Number of still frames to confirm a move with. More frames make
+   * recognition more reliable but switch the clock later.
+   */
+  void set_confirmation_frames(int frames);
+
+  /**
+   * Directory to keep detected board in between restarts. Saved board is
+   * used at game start if it still matches what camera sees. Empty string,
+   * the default, always detects the board.
+   */
+  void set_calibration_directory(std::string directory);
+
+  /**
+   * Use given perspective transform, found in a full resolution frame, to
+   * warp frames of any size.
+   */
+  void set_transform(const cv::Mat& transform);
+
+  /**
+   * Side in pixels of the top down board image squares are compared in.
+   * Motion is detected in image of half of that size. Smaller sizes cost
+   * less CPU, full size is the height of camera frame. Rounded to a multiple
+   * of 16 between 128 and full size.
+   */
+  void set_analysis_size(int size);
+
+  /**
+   * Warp camera image to the top down view of the board of analysis size.
+   */
+  void warp(const cv::Mat& image, cv::Mat& warped);
+
+  /**
+   * Variance of Laplacian of downsampled grayscale image. Low values mean
+   * that image is blurry.
+   */
+  double sharpness(const cv::Mat& image);
+
+  /**
+   * Stream of what camera sees for consumers other than the callbacks.
+   */
+  VisionEvents& events();
+
  private:
   cv::Mat frame;
   cv::Mat perspective_transform;
+
+  /**
+   * Fixed point lookup tables mapping board image pixels to camera frame
+   * pixels, equivalent to perspective_transform.
+   */
+  cv::Mat warp_map1;
+  cv::Mat warp_map2;
+  cv::Size warp_frame_size;
   cv::Mat img_perspective;
+
+  /**
+   * Grayscale version of the last frame seen while not playing, for
+   * resume_game.
+   */
+  cv::Mat frame_gray;
+
+  /**
+   * Grayscale version of the frame being processed, owned by processing
+   * thread.
+   */
+  cv::Mat captured_gray;
+  cv::Mat gray_perspective;
+  cv::Mat motion_perspective;
   cv::Mat last_move;
-  cv::Ptr<cv::BackgroundSubtractor> bg_sub;
+
+  /**
+   * Running average of still board images since the last move, last_move
+   * is its 8 bit version.
+   */
+  cv::Mat move_reference;
+  MotionDetector motion;
   std::mutex frame_mutex;
+  V4l2Camera camera;
+  spscq::Ring<Frame, 4> frames;
   std::function<void()> on_move_start;
-  std::function<std::string(SquareChange[64])> on_move_finish;
-  bool moving = false;
+  std::function<std::string(FinishedMove&)> on_move_finish;
+  std::function<void()> on_board_not_found;
+  bool playing = false;
+
+  /**
+   * Game started, waiting for board detection to finish.
+   */
+  bool starting = false;
+
+  /**
+   * Board should be detected in the next processed frame.
+   */
+  bool detection_requested = false;
+
+  /**
+   * Board published by detection thread and the one processing thread
+   * uses.
+   */
+  std::atomic<std::shared_ptr<const Board>> detected_board;
+  std::shared_ptr<const Board> board;
+  std::string calibration_directory;
+  BoardTracker tracker;
+  ChangeVote vote;
+  std::atomic<int> confirmation_frames;
+  std::chrono::steady_clock::time_point last_tracked;
+  std::chrono::steady_clock::time_point hand_left;
+  FrameScheduler scheduler;
+  int analysis_size;
+  VisionEvents vision_events;
+
+  /**
+   * Frames dropped by capture and how many of them were published as
+   * events by processing thread.
+   */
+  std::atomic<std::uint64_t> dropped_frames = 0;
+  std::uint64_t reported_dropped_frames = 0;
+  bool board_lost = false;
   int ply_index;
 
+  cv::Mat sharpness_sample;
+  cv::Mat sharpness_gray;
+  cv::Mat sharpness_laplacian;
+
   void capture_frames();
-  void save_differences(cv::Mat& img_perspective, cv::Mat& colored, std::string file_name);
+  void detect_board_in_background(cv::Mat snapshot);
+
+  /**
+   * Capture frames using V4L2 buffers directly. Returns false if camera
+   * could not be opened or reopened at a new resolution this way.
+   */
+  bool capture_v4l2_frames();
+  void capture_opencv_frames();
+
+  /**
+   * Return processed frame and its camera buffer.
+   */
+  void release_frame(Frame& frame);
+  void process_frames();
+
+  /**
+   * Precompute lookup tables for warp from perspective_transform for frames
+   * of given size.
+   */
+  void prepare_warp(cv::Size frame_size);
+
+  /**
+   * Warp grayscale camera frame to top down view used for square
+   * differences and downsample it further for motion detection.
+   */
+  void build_pyramid(const cv::Mat& gray);
+
+  /**
+   * Compare following moves with given top down board image.
+   */
+  void reset_reference(const cv::Mat& board);
+
+  /**
+   * Follow the board into the frame being processed, updating the transform
+   * and top down view if it moved. Returns true if it moved.
+   */
+  bool track_board(const Frame& captured);
+
+  /**
+   * Recognise the move from confirmation frames and prepare for the next
+   * one. Given frame lock is released while on_move_finish runs.
+   */
+  void finish_move(Frame& captured, const cv::Mat& diff, std::unique_lock<std::mutex>& lock);
+  void save_differences(const Frame& captured, const cv::Mat& diff,
+    const SquareChange changes[64], std::string file_name, bool failure = false);
 };
 
 
@@ -0,0 +1,54 @@
+#include "vision_events.hpp"
+#include <algorithm>
+
+VisionEvents::Subscription::Subscription(VisionEvents& events, std::uint64_t cursor)
+    : events(events), cursor(cursor) {
+}
+
+std::optional<VisionEvent> VisionEvents::Subscription::next(std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lock(events.mutex);
+  if (!events.changed.wait_for(lock, timeout, [&]() {
+        return events.closed || events.published > cursor;
+      }) || events.published == cursor) {
+    return std::nullopt;
+  }
+  std::uint64_t oldest = events.published - std::min<std::uint64_t>(events.published, events.ring.size());
+  if (cursor < oldest) {
+    missed_events += oldest - cursor;
+    cursor = oldest;
+  }
+  return events.ring[cursor++ % events.ring.size()];
+}
+
+std::uint64_t VisionEvents::Subscription::missed() const {
+  return missed_events;
+}
+
+VisionEvents::VisionEvents(std::size_t capacity)
+    : ring(capacity) {
+}
+
+void VisionEvents::publish(VisionEvent event) {
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (closed) {
+      return;
+    }
+    event.sequence = published;
+    ring[published++ % ring.size()] = event;
+  }
+  changed.notify_all();
+}
+
+VisionEvents::Subscription VisionEvents::subscribe() {
+  std::lock_guard<std::mutex> guard(mutex);
+  return Subscription(*this, published);
+}
+
+void VisionEvents::close() {
+  {
+    std::lock_guard<std::mutex> guard(mutex);
+    closed = true;
+  }
+  changed.notify_all();
+}
@@ -0,0 +1,129 @@
+#ifndef VISION_EVENTS_H_
+#define VISION_EVENTS_H_
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+/**
+ * Something camera saw, for consumers other than the game itself like
+ * recorders and metrics.
+ */
+class VisionEvent {
+ public:
+  enum class Type {
+    /**
+     * Hand entered the board.
+     */
+    MotionStart,
+
+    /**
+     * Board became still again.
+     */
+    MotionEnd,
+
+    /**
+     * Change of each square since the last move in a frame confirming it.
+     */
+    SquareScores,
+
+    /**
+     * Board tracker couldn't find the board anymore.
+     */
+    BoardLost,
+
+    /**
+     * Frames were dropped because processing was too slow.
+     */
+    FrameDropped
+  };
+
+  Type type;
+
+  /**
+   * Capture time and camera sequence number of the frame event is about.
+   */
+  std::chrono::steady_clock::time_point timestamp;
+  std::uint64_t frame_sequence = 0;
+
+  /**
+   * Position in the stream, set by VisionEvents::publish. Consecutive for
+   * consecutive events.
+   */
+  std::uint64_t sequence = 0;
+
+  /**
+   * SquareScores: change of each square indexed by chess square, a1 = 0.
+   */
+  std::array<double, 64> scores{};
+
+  /**
+   * FrameDropped: number of frames dropped since the previous such event.
+   */
+  std::uint64_t dropped = 0;
+};
+
+/**
+ * Bounded stream of vision events which any number of subscribers read at
+ * their own pace. Publisher never waits for subscribers, the oldest events
+ * are overwritten instead and subscribers which fall behind skip them.
+ */
+class VisionEvents {
+ public:
+  class Subscription {
+   public:
+    /**
+     * Wait up to given time for the next event. Returns nothing on timeout
+     * or if stream was closed.
+     */
+    std::optional<VisionEvent> next(std::chrono::milliseconds timeout);
+
+    /**
+     * Number of events overwritten before this subscriber read them.
+     */
+    std::uint64_t missed() const;
+
+   private:
+    friend class VisionEvents;
+
+    Subscription(VisionEvents& events, std::uint64_t cursor);
+
+    VisionEvents& events;
+    std::uint64_t cursor;
+    std::uint64_t missed_events = 0;
+  };
+
+  /**
+   * Keep up to given number of the latest events.
+   */
+  VisionEvents(std::size_t capacity = 256);
+
+  /**
+   * Add event to the stream, overwriting the oldest one if stream is full.
+   */
+  void publish(VisionEvent event);
+
+  /**
+   * Read events published from now on.
+   */
+  Subscription subscribe();
+
+  /**
+   * Wake up all subscribers, nothing is published afterwards.
+   */
+  void close();
+
+ private:
+  std::vector<VisionEvent> ring;
+  std::uint64_t published = 0;
+  bool closed = false;
+  std::mutex mutex;
+  std::condition_variable changed;
+};
+
+#endif  // VISION_EVENTS_H_
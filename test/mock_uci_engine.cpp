@@ -0,0 +1,138 @@
+/**
+ * Fake UCI engine with scripted behaviour for deterministic tests and
+ * benchmarks of the engine pipeline without a real engine.
+ *
+ * Options:
+ *   --delay ms        time spent on each depth of the search
+ *   --depth n         deepest depth reached by "go infinite"
+ *   --flood n         extra "info currmove" lines printed for each depth
+ *   --crash-after n   exit abruptly while running the n-th search
+ *   --score move=cp   score reported for given move, can be repeated
+ */
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+static int delay_ms = 0;
+static int max_depth = 64;
+static int flood = 0;
+static int crash_after = -1;
+static std::map<std::string, int> scripted_scores;
+
+static std::atomic<bool> stopped;
+static std::thread search_thread;
+static int searches = 0;
+
+/**
+ * Score of the move not given on the command line is derived from its name
+ * so it is the same between runs.
+ */
+static int score(const std::string& move) {
+  auto scripted = scripted_scores.find(move);
+  if (scripted != scripted_scores.end()) {
+    return scripted->second;
+  }
+  int sum = 0;
+  for (char c : move) {
+    sum = sum * 31 + c;
+  }
+  return std::abs(sum) % 101 - 50;
+}
+
+static void search(int depth, bool infinite, std::string move, bool crash) {
+  std::string output;
+  int value = score(move);
+  for (int d = 1; d <= depth && !stopped; d++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+    if (crash) {
+      std::_Exit(1);
+    }
+    output.clear();
+    for (int i = 0; i < flood; i++) {
+      output += "info depth " + std::to_string(d) + " currmove " + move +
+        " currmovenumber 1 nodes " + std::to_string(d * 1000 + i) + " nps 1000000\n";
+    }
+    output += "info depth " + std::to_string(d) + " seldepth " + std::to_string(d + 2) +
+      " multipv 1 score cp " + std::to_string(value) + " nodes " + std::to_string(d * 1000 + flood) +
+      " nps 1000000 hashfull " + std::to_string(d) + " time " + std::to_string(d * delay_ms) +
+      " pv " + move + "\n";
+    fputs(output.c_str(), stdout);
+    fflush(stdout);
+  }
+  // Like real engines "go infinite" doesn't finish before "stop"
+  while (infinite && !stopped) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  printf("bestmove %s\n", move.c_str());
+  fflush(stdout);
+}
+
+static void stop() {
+  stopped = true;
+  if (search_thread.joinable()) {
+    search_thread.join();
+  }
+}
+
+int main(int argc, char** argv) {
+  for (int i = 1; i + 1 < argc; i += 2) {
+    std::string option = argv[i];
+    std::string value = argv[i + 1];
+    if (option == "--delay") {
+      delay_ms = std::stoi(value);
+    } else if (option == "--depth") {
+      max_depth = std::stoi(value);
+    } else if (option == "--flood") {
+      flood = std::stoi(value);
+    } else if (option == "--crash-after") {
+      crash_after = std::stoi(value);
+    } else if (option == "--score") {
+      size_t separator = value.find('=');
+      scripted_scores[value.substr(0, separator)] = std::stoi(value.substr(separator + 1));
+    }
+  }
+  std::string line;
+  while (std::getline(std::cin, line)) {
+    std::istringstream tokens(line);
+    std::string command;
+    tokens >> command;
+    if (command == "uci") {
+      printf("id name mock\nuciok\n");
+      fflush(stdout);
+    } else if (command == "isready") {
+      // Answered while searching, like real engines do
+      printf("readyok\n");
+      fflush(stdout);
+    } else if (command == "go") {
+      stop();
+      int depth = max_depth;
+      bool infinite = true;
+      std::string move = "0000";
+      std::string token;
+      while (tokens >> token) {
+        if (token == "depth") {
+          tokens >> depth;
+          infinite = false;
+        } else if (token == "searchmoves") {
+          tokens >> move;
+        }
+      }
+      searches++;
+      stopped = false;
+      search_thread = std::thread(search, depth, infinite, move, searches == crash_after);
+    } else if (command == "stop") {
+      stop();
+    } else if (command == "quit") {
+      break;
+    }
+  }
+  stop();
+  return 0;
+}
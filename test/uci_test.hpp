@@ -1,5 +1,9 @@
 #include <gtest/gtest.h>
+#include "../src/line_reader.hpp"
+#include "../src/logger.hpp"
 #include "../src/uci.hpp"
+#include <algorithm>
+#include <unistd.h>
 
 TEST(UCITest, InitialPosition) {
   UniversalChessInterface uci("/usr/games/stockfish");
@@ -22,3 +26,210 @@ TEST(UCITest, InitialPosition) {
   result = uci.evaluate_moves(position, position.generate_legal_moves());
   EXPECT_LT(result.back().score.value, 0);
 }
+
+TEST(UCITest, TimeBudget) {
+  if (access("/usr/games/stockfish", X_OK) != 0) {
+    GTEST_SKIP() << "Stockfish is not installed, MockEngineTimeBudget covers the scheduling";
+  }
+  UniversalChessInterface uci("/usr/games/stockfish");
+
+  chess::Position position;
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  auto result = uci.evaluate_moves_within(position, position.generate_legal_moves(), 1s);
+  std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
+
+  EXPECT_EQ(result.size(), 20);
+  EXPECT_LT(elapsed, 1100ms);
+  EXPECT_LT(result.front().score.value, result.back().score.value);
+}
+
+TEST(UCITest, MockEngineDepth) {
+  UniversalChessInterface uci(std::vector<std::string>({
+    "./mock_uci_engine", "--delay", "1", "--score", "e2e4=80", "--score", "f2f3=-90"
+  }));
+
+  chess::Position position;
+
+  auto result = uci.evaluate_moves(position, position.generate_legal_moves(), 5);
+
+  ASSERT_EQ(result.size(), 20);
+  EXPECT_EQ(result.back().move.to_string(), "e2e4");
+  EXPECT_EQ(result.back().score.value, 80);
+  EXPECT_EQ(result.back().score.depth, 5);
+  EXPECT_EQ(result.front().move.to_string(), "f2f3");
+  for (auto& record : uci.telemetry.records()) {
+    EXPECT_TRUE(record.finished);
+    EXPECT_EQ(record.timeline.size(), 5);
+  }
+}
+
+TEST(UCITest, MockEngineTimeBudget) {
+  UniversalChessInterface uci(std::vector<std::string>({
+    "./mock_uci_engine", "--delay", "10"
+  }));
+
+  chess::Position position;
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  auto result = uci.evaluate_moves_within(position, position.generate_legal_moves(), 2s);
+  std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
+
+  // Infinite searches end only when the budget runs out
+  EXPECT_GE(elapsed, 2s);
+  EXPECT_EQ(result.size(), 20);
+  EXPECT_TRUE(std::is_sorted(result.begin(), result.end()));
+  for (auto& move : result) {
+    EXPECT_GE(move.score.depth, 3);
+  }
+  std::vector<SearchRecord> records = uci.telemetry.records();
+  EXPECT_EQ(records.size(), 20);
+  for (auto& record : records) {
+    // Stopped rather than finished by the engine
+    EXPECT_FALSE(record.finished);
+  }
+}
+
+TEST(UCITest, MockEngineFlood) {
+  const int depth = 10;
+  const int flood = 1000;
+  UniversalChessInterface uci(std::vector<std::string>({
+    "./mock_uci_engine", "--flood", std::to_string(flood)
+  }));
+
+  chess::Position position;
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  auto result = uci.evaluate_moves(position, position.generate_legal_moves(), depth, 30s);
+  std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
+
+  EXPECT_EQ(result.size(), 20);
+  int lines = result.size() * depth * (flood + 1);
+  logger::info("Processed %d info lines in %dms", lines,
+    (int)std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count());
+}
+
+TEST(UCITest, MockEngineLatency) {
+  UniversalChessInterface uci(std::vector<std::string>({"./mock_uci_engine"}));
+
+  chess::Position position;
+  std::vector<chess::Move> moves = {position.generate_legal_moves().front()};
+
+  std::vector<std::chrono::microseconds> latencies;
+  for (int i = 0; i < 200; i++) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    auto result = uci.evaluate_moves(position, moves, 1);
+    latencies.push_back(std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - start));
+    ASSERT_EQ(result.size(), 1);
+  }
+  std::sort(latencies.begin(), latencies.end());
+  std::chrono::microseconds p50 = latencies[latencies.size() / 2];
+  std::chrono::microseconds p99 = latencies[latencies.size() * 99 / 100];
+  logger::info("Engine round trip p50 %dus, p99 %dus", (int)p50.count(), (int)p99.count());
+}
+
+TEST(UCITest, MockEngineCrash) {
+  UniversalChessInterface uci(std::vector<std::string>({
+    "./mock_uci_engine", "--delay", "1", "--crash-after", "5"
+  }));
+
+  chess::Position position;
+  position.move("e2e4");
+
+  auto result = uci.evaluate_moves(position, position.generate_legal_moves(), 3);
+
+  // Engine crashes on every 5th search and is restarted each time, all
+  // searches still reach the requested depth
+  EXPECT_EQ(result.size(), 20);
+  EXPECT_TRUE(std::is_sorted(result.begin(), result.end()));
+  for (auto& move : result) {
+    EXPECT_EQ(move.score.depth, 3);
+  }
+}
+
+TEST(UCITest, ParseInfo) {
+  std::optional<Info> info = parse_info(
+    "info depth 12 seldepth 17 multipv 1 score cp -35 upperbound nodes 123456 "
+    "nps 987654 hashfull 12 tbhits 0 time 125 pv e7e5 g1f3 b8c6");
+
+  ASSERT_TRUE(info.has_value());
+  EXPECT_EQ(info->depth, 12);
+  EXPECT_EQ(info->seldepth, 17);
+  EXPECT_EQ(info->multipv, 1);
+  ASSERT_TRUE(info->score.has_value());
+  EXPECT_EQ(info->score->value, -35);
+  EXPECT_EQ(info->score->unit, chess::ScoreUnit::Centipawn);
+  EXPECT_EQ(info->score->depth, 12);
+  EXPECT_EQ(info->bound, ScoreBound::Upper);
+  EXPECT_EQ(info->nodes, 123456);
+  EXPECT_EQ(info->nps, 987654);
+  EXPECT_EQ(info->pv, "e7e5 g1f3 b8c6");
+}
+
+TEST(UCITest, ParseInfoMate) {
+  std::optional<Info> info = parse_info("info depth 3 score mate -2 pv h5f7");
+
+  ASSERT_TRUE(info.has_value());
+  ASSERT_TRUE(info->score.has_value());
+  EXPECT_EQ(info->score->value, -2);
+  EXPECT_EQ(info->score->unit, chess::ScoreUnit::MateIn);
+  EXPECT_EQ(info->bound, ScoreBound::Exact);
+  EXPECT_EQ(info->pv, "h5f7");
+}
+
+TEST(UCITest, ParseNotInfo) {
+  EXPECT_FALSE(parse_info("bestmove e2e4 ponder e7e5").has_value());
+  EXPECT_FALSE(parse_info("").has_value());
+  EXPECT_FALSE(parse_info("info depth 5 currmove e2e4")->score.has_value());
+}
+
+TEST(UCITest, LineReader) {
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  LineReader reader(fds[0]);
+  std::vector<std::string> lines;
+  auto collect = [&](std::string_view line) {
+    lines.emplace_back(line);
+  };
+
+  ASSERT_EQ(write(fds[1], "uciok\r\nread", 11), 11);
+  EXPECT_TRUE(reader.read(collect));
+  ASSERT_EQ(write(fds[1], "yok\n", 4), 4);
+  EXPECT_TRUE(reader.read(collect));
+  close(fds[1]);
+  EXPECT_FALSE(reader.read(collect));
+  close(fds[0]);
+
+  EXPECT_EQ(lines, std::vector<std::string>({"uciok", "readyok"}));
+}
+
+TEST(UCITest, SearchTelemetry) {
+  SearchTelemetry telemetry;
+
+  telemetry.start("go depth 2 searchmoves e2e4");
+  telemetry.add(parse_info("info depth 1 seldepth 1 score cp 20 nodes 20 nps 2000 pv e2e4").value());
+  telemetry.add(parse_info("info depth 2 currmove e2e4 currmovenumber 1").value());
+  telemetry.add(parse_info("info depth 2 seldepth 3 score cp 35 lowerbound nodes 80 nps 4000 pv e2e4").value());
+  telemetry.add(parse_info("info depth 2 seldepth 3 score cp 30 nodes 90 nps 4500 hashfull 1 pv e2e4 e7e5").value());
+  telemetry.finish();
+  telemetry.start("go depth 2 searchmoves d2d4");
+  telemetry.add(parse_info("info depth 1 seldepth 1 score cp 10 nodes 20 nps 2000 pv d2d4").value());
+  telemetry.abandon();
+
+  std::vector<SearchRecord> records = telemetry.records();
+  ASSERT_EQ(records.size(), 2);
+  EXPECT_TRUE(records[0].finished);
+  ASSERT_EQ(records[0].timeline.size(), 2);
+  EXPECT_EQ(records[0].timeline[1].depth, 2);
+  EXPECT_EQ(records[0].score->value, 30);
+  EXPECT_EQ(records[0].nodes, 90);
+  EXPECT_EQ(records[0].nps, 4500);
+  EXPECT_EQ(records[0].hashfull, 1);
+  EXPECT_EQ(records[0].pv, "e2e4 e7e5");
+  EXPECT_FALSE(records[1].finished);
+  EXPECT_EQ(records[1].score->value, 10);
+
+  telemetry.clear();
+  EXPECT_TRUE(telemetry.records().empty());
+}
@@ -0,0 +1,140 @@
+/**
+ * Measures cost of each video processing stage on test board images placed
+ * into camera frames of several resolutions. Run from the build directory,
+ * optionally with board images pattern and analysis size.
+ */
+#include "../src/frame.hpp"
+#include "../src/motion_detector.hpp"
+#include "../src/video_capture.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+
+/**
+ * Number of times all board images are processed at each resolution.
+ */
+const int ITERATIONS = 20;
+
+const char* STAGES[] = {
+  "gray", "blur check", "pyramid", "motion", "difference", "square sums", "pipeline"
+};
+const int STAGE_COUNT = sizeof(STAGES) / sizeof(STAGES[0]);
+
+class Timings {
+ public:
+  std::vector<double> samples[STAGE_COUNT];
+
+  double percentile(int stage, double fraction) {
+    std::vector<double>& sorted = samples[stage];
+    std::sort(sorted.begin(), sorted.end());
+    return sorted[std::min(sorted.size() - 1, (std::size_t)(fraction * sorted.size()))];
+  }
+};
+
+/**
+ * Board corners (bottom left, top left, top right, bottom right) in a
+ * 864x480 camera frame.
+ */
+static std::vector<cv::Point2f> board_corners(cv::Size size) {
+  float sx = size.width / 864.0f;
+  float sy = size.height / 480.0f;
+  return {{200 * sx, 440 * sy}, {260 * sx, 60 * sy}, {620 * sx, 60 * sy}, {680 * sx, 440 * sy}};
+}
+
+static cv::Mat camera_frame(const cv::Mat& board, cv::Size size) {
+  std::vector<cv::Point2f> from({
+    {0.0f, (float)board.rows}, {0.0f, 0.0f}, {(float)board.cols, 0.0f}, {(float)board.cols, (float)board.rows}
+  });
+  cv::Mat transform = cv::getPerspectiveTransform(from, board_corners(size));
+  cv::Mat frame(size, CV_8UC3, cv::Scalar(90, 90, 90));
+  cv::warpPerspective(board, frame, transform, size, cv::INTER_LINEAR, cv::BORDER_TRANSPARENT);
+  return frame;
+}
+
+static void benchmark(const std::vector<cv::Mat>& boards, cv::Size size, int analysis_size) {
+  VideoCapture video_capture(
+    []() {
+    },
+    [](FinishedMove& finished) {
+      return "";
+    }
+  );
+  std::vector<cv::Point2f> top_down({{0.0f, 480.0f}, {0.0f, 0.0f}, {480.0f, 0.0f}, {480.0f, 480.0f}});
+  video_capture.set_analysis_size(analysis_size);
+  video_capture.set_transform(cv::getPerspectiveTransform(board_corners({864, 480}), top_down));
+  std::vector<Frame> frames(boards.size());
+  for (int i = 0; i < boards.size(); i++) {
+    frames[i].image = camera_frame(boards[i], size);
+  }
+
+  Timings timings;
+  MotionDetector motion;
+  cv::Mat gray, warped, small, last_move, diff;
+  SquareChange changes[64];
+  for (int iteration = 0; iteration < ITERATIONS; iteration++) {
+    for (Frame& frame : frames) {
+      std::chrono::steady_clock::time_point times[STAGE_COUNT];
+      times[0] = std::chrono::steady_clock::now();
+      frame_to_gray(frame, gray);
+      times[1] = std::chrono::steady_clock::now();
+      video_capture.sharpness(gray);
+      times[2] = std::chrono::steady_clock::now();
+      video_capture.warp(gray, warped);
+      cv::pyrDown(warped, small);
+      times[3] = std::chrono::steady_clock::now();
+      if (last_move.empty()) {
+        warped.copyTo(last_move);
+        motion.reset(small);
+      }
+      motion.update(small);
+      times[4] = std::chrono::steady_clock::now();
+      move_difference(last_move, warped, diff);
+      times[5] = std::chrono::steady_clock::now();
+      square_changes(diff, warped.cols / 48, changes);
+      times[6] = std::chrono::steady_clock::now();
+      for (int stage = 0; stage < STAGE_COUNT - 1; stage++) {
+        timings.samples[stage].push_back(
+          std::chrono::duration<double, std::milli>(times[stage + 1] - times[stage]).count());
+      }
+      timings.samples[STAGE_COUNT - 1].push_back(
+        std::chrono::duration<double, std::milli>(times[STAGE_COUNT - 1] - times[0]).count());
+      warped.copyTo(last_move);
+    }
+  }
+
+  printf("%dx%d analysed at %dx%d\n", size.width, size.height, warped.cols, warped.rows);
+  printf("  %-12s %8s %8s\n", "stage", "p50 ms", "p99 ms");
+  for (int stage = 0; stage < STAGE_COUNT; stage++) {
+    printf("  %-12s %8.3f %8.3f\n", STAGES[stage],
+      timings.percentile(stage, 0.5), timings.percentile(stage, 0.99));
+  }
+  std::vector<double>& pipeline = timings.samples[STAGE_COUNT - 1];
+  double total = 0;
+  for (double sample : pipeline) {
+    total += sample;
+  }
+  printf("  %.1f frames/second\n", 1000.0 * pipeline.size() / total);
+}
+
+int main(int argc, char** argv) {
+  std::string pattern = argc > 1 ? argv[1] : "../test/boards/move*.jpg";
+  int analysis_size = argc > 2 ? std::stoi(argv[2]) : 240;
+  std::vector<cv::String> files;
+  cv::glob(pattern, files, false);
+  std::sort(files.begin(), files.end());
+  std::vector<cv::Mat> boards;
+  for (auto& file : files) {
+    boards.push_back(cv::imread(file));
+  }
+  if (boards.empty()) {
+    fprintf(stderr, "No images match %s\n", pattern.c_str());
+    return 1;
+  }
+  for (cv::Size size : {cv::Size(640, 360), cv::Size(864, 480), cv::Size(1280, 720), cv::Size(1920, 1080)}) {
+    benchmark(boards, size, analysis_size);
+  }
+  return 0;
+}
@@ -1,12 +1,78 @@
 #include <gtest/gtest.h>
+#include "../src/calibration.hpp"
+#include "../src/debug_images.hpp"
+#include "../src/occupancy.hpp"
 #include "../src/video_capture.hpp"
+#include <filesystem>
+#include <linux/videodev2.h>
+#include <numeric>
 #include <opencv2/opencv.hpp>
+#include <set>
+#include <thread>
+
+/**
+ * Board corners in camera frames made by camera_frame and where they are in
+ * the top down view.
+ */
+static const std::vector<cv::Point2f> CAMERA_CORNERS({{200, 440}, {260, 60}, {620, 60}, {680, 440}});
+static const std::vector<cv::Point2f> TOP_DOWN_CORNERS({{0, 480}, {0, 0}, {480, 0}, {480, 480}});
+
+/**
+ * Perspective transform of the board in frames made by camera_frame.
+ */
+static cv::Mat camera_transform() {
+  return cv::getPerspectiveTransform(CAMERA_CORNERS, TOP_DOWN_CORNERS);
+}
+
+/**
+ * Top down board image as camera would see it. It is pasted into a real
+ * camera frame so the frame is as sharp as one.
+ */
+static cv::Mat camera_frame(const cv::Mat& board) {
+  cv::Mat frame = cv::imread("../test/boards/big-wooden.jpg");
+  cv::warpPerspective(board, frame, camera_transform().inv(), frame.size(), cv::INTER_LINEAR,
+    cv::BORDER_TRANSPARENT);
+  return frame;
+}
+
+/**
+ * Write frames for ReplaySource with repeat 5 into directory/frames: each
+ * of the top down board images for 40 frames with a hand over the board for
+ * 5 frames in between. Board seen in the first image is saved into
+ * directory/calibration so it doesn't need to be detected.
+ */
+static void write_replay(const std::string& directory, const std::vector<cv::Mat>& boards) {
+  std::filesystem::remove_all(directory);
+  std::filesystem::create_directories(directory + "/frames");
+  int index = 0;
+  auto write = [&](const cv::Mat& frame) {
+    std::string number = std::to_string(index++);
+    number.insert(number.begin(), 4 - number.size(), '0');
+    cv::imwrite(directory + "/frames/frame" + number + ".jpg", frame);
+  };
+  for (int i = 0; i < boards.size(); i++) {
+    if (i > 0) {
+      cv::Mat hand = boards[i].clone();
+      cv::rectangle(hand, {240, 0}, {480, 300}, {0, 0, 0}, cv::FILLED);
+      write(camera_frame(hand));
+    }
+    cv::Mat frame = camera_frame(boards[i]);
+    for (int j = 0; j < 8; j++) {
+      write(frame);
+    }
+  }
+  Board board;
+  board.perspective_transform = camera_transform();
+  cv::cvtColor(camera_frame(boards[0]), board.gray, cv::COLOR_BGR2GRAY);
+  cv::warpPerspective(board.gray, board.reference, board.perspective_transform, {480, 480});
+  save_calibration(directory + "/calibration", board);
+}
 
 TEST(VideoCaptureTest, BigWoodenBoard) {
   VideoCapture video_capture(
     [&]() {
     },
-    [&](SquareChange changes[64]) {
+    [&](FinishedMove& finished) {
       return "";
     }
   );
@@ -18,7 +84,7 @@ TEST(VideoCaptureTest, SmallMagneticFlatPiecesBoard) {
   VideoCapture video_capture(
     [&]() {
     },
-    [&](SquareChange changes[64]) {
+    [&](FinishedMove& finished) {
       return "";
     }
   );
@@ -26,6 +92,290 @@ TEST(VideoCaptureTest, SmallMagneticFlatPiecesBoard) {
   video_capture.detect_board(frame, "small-magnetic-flat-pieces");
 }
 
+TEST(VideoCaptureTest, SquareChanges) {
+  cv::Mat diff(480, 480, CV_8UC1);
+  cv::randu(diff, 0, 256);
+  int margin = 10;
+  int square_size = diff.cols / 8;
+
+  SquareChange changes[64];
+  square_changes(diff, margin, changes);
+
+  for (int x = 0; x < 8; x++) {
+    for (int y = 0; y < 8; y++) {
+      cv::Rect cell(
+        x * square_size + margin / 2, y * square_size + margin / 2,
+        square_size - margin, square_size - margin);
+      const SquareChange& change = changes[y * 8 + x];
+      EXPECT_EQ(change.x, x);
+      EXPECT_EQ(change.y, y);
+      EXPECT_EQ(change.index, (7 - x) * 8 + (7 - y));
+      EXPECT_EQ(change.change, cv::sum(diff(cell))[0]);
+    }
+  }
+}
+
+TEST(VideoCaptureTest, MotionDetector) {
+  cv::Mat board = cv::imread("../test/boards/move000.jpg", cv::IMREAD_GRAYSCALE);
+  MotionDetector motion;
+  motion.reset(board);
+
+  EXPECT_EQ(motion.update(board), Motion::None);
+
+  // Hand enters the board from the side
+  cv::Mat hand = board.clone();
+  cv::rectangle(hand, {0, 180}, {240, 300}, {0}, cv::FILLED);
+  EXPECT_EQ(motion.update(hand), Motion::Started);
+  EXPECT_TRUE(motion.moving());
+  EXPECT_GT(motion.activity()[3 * 8 + 0], 0.9);
+  EXPECT_EQ(motion.activity()[7 * 8 + 7], 0);
+
+  // Piece moved from one square to another and the hand is gone
+  cv::Mat moved = board.clone();
+  cv::rectangle(moved, {180, 360}, {240, 420}, {255}, cv::FILLED);
+  cv::rectangle(moved, {180, 240}, {240, 300}, {0}, cv::FILLED);
+  Motion state = Motion::None;
+  int frames = 0;
+  while (state == Motion::None && frames++ < 100) {
+    state = motion.update(moved);
+  }
+  EXPECT_EQ(state, Motion::Finished);
+  EXPECT_LT(frames, 10);
+  EXPECT_FALSE(motion.moving());
+}
+
+TEST(VideoCaptureTest, FrameScheduler) {
+  FrameScheduler scheduler(1280, 720);
+  FrameScheduler::Mode mode = scheduler.mode();
+  EXPECT_EQ(mode.width, 1280);
+  EXPECT_GT(mode.interval.count(), 0);
+  scheduler.set_playing(true);
+  mode = scheduler.mode();
+  EXPECT_EQ(mode.width, 1280);
+  EXPECT_EQ(mode.height, 720);
+  EXPECT_EQ(mode.interval.count(), 0);
+
+  // Nothing happened for a while
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now() + std::chrono::seconds(6);
+  mode = scheduler.mode(now);
+  EXPECT_EQ(mode.width, 640);
+  EXPECT_EQ(mode.height, 360);
+  EXPECT_GT(mode.interval.count(), 0);
+  // Hand over the board brings full rate back immediately
+  scheduler.motion(now);
+  mode = scheduler.mode(now);
+  EXPECT_EQ(mode.width, 1280);
+  EXPECT_EQ(mode.interval.count(), 0);
+  now += std::chrono::seconds(3);
+  EXPECT_EQ(scheduler.mode(now).width, 640);
+  // Opponent's reply is expected for longer after a move
+  scheduler.move_finished(now);
+  EXPECT_EQ(scheduler.mode(now + std::chrono::seconds(4)).width, 1280);
+  EXPECT_EQ(scheduler.mode(now + std::chrono::seconds(6)).width, 640);
+  scheduler.set_playing(false);
+  EXPECT_EQ(scheduler.mode(now + std::chrono::seconds(6)).width, 1280);
+}
+
+TEST(VideoCaptureTest, FrameToGray) {
+  Frame yuyv;
+  yuyv.image = cv::Mat(4, 8, CV_8UC2, cv::Scalar(100, 128));
+  yuyv.format = V4L2_PIX_FMT_YUYV;
+  cv::Mat gray;
+  frame_to_gray(yuyv, gray);
+  EXPECT_EQ(gray.size(), cv::Size(8, 4));
+  EXPECT_EQ(cv::countNonZero(gray != 100), 0);
+
+  Frame nv12;
+  nv12.image = cv::Mat(6, 8, CV_8UC1, cv::Scalar(128));
+  nv12.format = V4L2_PIX_FMT_NV12;
+  frame_to_gray(nv12, gray);
+  EXPECT_EQ(gray.size(), cv::Size(8, 4));
+  // Luma plane is used without copying
+  EXPECT_EQ(gray.data, nv12.image.data);
+}
+
+TEST(VideoCaptureTest, DebugImages) {
+  std::filesystem::create_directories("debug-images");
+  cv::Mat image(8, 8, CV_8UC1, cv::Scalar(0));
+  debug_images::configure(debug_images::Level::OnFailure);
+  EXPECT_FALSE(debug_images::enabled());
+  EXPECT_TRUE(debug_images::enabled(true));
+  debug_images::write("debug-images/success.png", image);
+  debug_images::write("debug-images/failure.png", image, true);
+  debug_images::flush();
+  debug_images::configure(debug_images::Level::Always);
+  EXPECT_FALSE(std::filesystem::exists("debug-images/success.png"));
+  EXPECT_TRUE(std::filesystem::exists("debug-images/failure.png"));
+  // Clearing is ordered with writes queued before and after it
+  debug_images::write("debug-images/before.png", image);
+  debug_images::clear_directory("debug-images");
+  debug_images::write("debug-images/after.png", image);
+  debug_images::flush();
+  EXPECT_FALSE(std::filesystem::exists("debug-images/failure.png"));
+  EXPECT_FALSE(std::filesystem::exists("debug-images/before.png"));
+  EXPECT_TRUE(std::filesystem::exists("debug-images/after.png"));
+  EXPECT_EQ(debug_images::parse_level("off"), debug_images::Level::Off);
+}
+
+TEST(VideoCaptureTest, BoardTracker) {
+  int side = 480;
+  cv::Mat board(side, side, CV_8UC1);
+  for (int i = 0; i < 64; i++) {
+    int square = side / 8;
+    board(cv::Rect(i % 8 * square, i / 8 * square, square, square)).setTo((i + i / 8) % 2 ? 40 : 200);
+  }
+  cv::Mat transform = camera_transform();
+  cv::Mat frame(480, 864, CV_8UC1, cv::Scalar(90));
+  cv::warpPerspective(board, frame, transform.inv(), frame.size(), cv::INTER_LINEAR, cv::BORDER_TRANSPARENT);
+  cv::Mat bumped;
+  cv::Mat shift = (cv::Mat_<double>(2, 3) << 1, 0, 6, 0, 1, -4);
+  cv::warpAffine(frame, bumped, shift, frame.size(), cv::INTER_LINEAR, cv::BORDER_CONSTANT, 90);
+
+  BoardTracker tracker({864, 480});
+  tracker.reset(frame, transform);
+  EXPECT_FALSE(tracker.track(frame).has_value());
+  std::optional<cv::Mat> tracked = tracker.track(bumped);
+  ASSERT_TRUE(tracked.has_value());
+  std::vector<cv::Point2f> tracked_corners;
+  cv::perspectiveTransform(TOP_DOWN_CORNERS, tracked_corners, tracked.value().inv());
+  for (int i = 0; i < 4; i++) {
+    EXPECT_NEAR(tracked_corners[i].x, CAMERA_CORNERS[i].x + 6, 0.5);
+    EXPECT_NEAR(tracked_corners[i].y, CAMERA_CORNERS[i].y - 4, 0.5);
+  }
+  // Transform already in use is not returned again
+  EXPECT_FALSE(tracker.track(bumped).has_value());
+  // Board moved back to where it was
+  tracked = tracker.track(frame);
+  ASSERT_TRUE(tracked.has_value());
+  cv::perspectiveTransform(TOP_DOWN_CORNERS, tracked_corners, tracked.value().inv());
+  for (int i = 0; i < 4; i++) {
+    EXPECT_NEAR(tracked_corners[i].x, CAMERA_CORNERS[i].x, 0.5);
+    EXPECT_NEAR(tracked_corners[i].y, CAMERA_CORNERS[i].y, 0.5);
+  }
+  EXPECT_FALSE(tracker.track(frame).has_value());
+  EXPECT_TRUE(tracker.found());
+  // Board covered or knocked away
+  cv::Mat blank(480, 864, CV_8UC1, cv::Scalar(90));
+  EXPECT_FALSE(tracker.track(blank).has_value());
+  EXPECT_FALSE(tracker.found());
+  EXPECT_FALSE(tracker.track(frame).has_value());
+  EXPECT_TRUE(tracker.found());
+}
+
+TEST(VideoCaptureTest, ReplaySource) {
+  ReplaySource source("../test/boards/move*.jpg", ReplaySource::Pacing::Fast, 3);
+  Frame frame;
+  int frames = 0;
+  std::chrono::steady_clock::time_point previous;
+  while (source.next(frame)) {
+    EXPECT_FALSE(frame.image.empty());
+    EXPECT_EQ(frame.sequence, frames);
+    if (frames > 0) {
+      EXPECT_GT(frame.timestamp, previous);
+    }
+    previous = frame.timestamp;
+    frames++;
+  }
+  EXPECT_EQ(frames, 12 * 3);
+
+  ReplaySource once("../test/boards/move*.jpg", ReplaySource::Pacing::Fast, 0);
+  frames = 0;
+  while (once.next(frame)) {
+    frames++;
+  }
+  EXPECT_EQ(frames, 12);
+
+  // Timestamps in names of different length
+  std::filesystem::remove_all("replay-timestamps-test");
+  std::filesystem::create_directories("replay-timestamps-test");
+  std::vector<std::pair<int, int>> images({{999, 20}, {1000, 30}, {50, 10}});
+  for (auto [time, value] : images) {
+    cv::imwrite("replay-timestamps-test/" + std::to_string(time) + ".png",
+      cv::Mat(8, 8, CV_8UC3, cv::Scalar(value, value, value)));
+  }
+  ReplaySource timed("replay-timestamps-test", ReplaySource::Pacing::Fast);
+  std::vector<int> values;
+  std::vector<std::chrono::steady_clock::time_point> timestamps;
+  while (timed.next(frame)) {
+    values.push_back(frame.image.at<cv::Vec3b>(0, 0)[0]);
+    timestamps.push_back(frame.timestamp);
+  }
+  EXPECT_EQ(values, std::vector<int>({10, 20, 30}));
+  ASSERT_EQ(timestamps.size(), 3);
+  EXPECT_EQ(timestamps[1] - timestamps[0], std::chrono::milliseconds(949));
+  EXPECT_EQ(timestamps[2] - timestamps[1], std::chrono::milliseconds(1));
+}
+
+TEST(VideoCaptureTest, Replay) {
+  std::vector<cv::String> files;
+  cv::glob("../test/boards/move*.jpg", files, false);
+  std::sort(files.begin(), files.end());
+  std::vector<cv::Mat> boards;
+  for (const cv::String& file : files) {
+    boards.push_back(cv::imread(file));
+  }
+  write_replay("replay-test", boards);
+
+  int started = 0;
+  std::vector<std::pair<int, int>> moves;
+  VideoCapture video_capture(
+    [&]() {
+      started++;
+    },
+    [&](FinishedMove& finished) {
+      moves.push_back(std::minmax(finished.changes[0].index, finished.changes[1].index));
+      return "move";
+    }
+  );
+  video_capture.set_calibration_directory("replay-test/calibration");
+  ReplaySource source("replay-test/frames", ReplaySource::Pacing::Fast, 5);
+  video_capture.replay(source);
+  EXPECT_EQ(started, (int)files.size() - 1);
+  ASSERT_EQ(moves.size(), files.size() - 1);
+  std::vector<std::string> expected({"d2d4", "b7b5", "e2e4", "g8f6", "g1f3", "c8a6"});
+  for (int i = 0; i < expected.size(); i++) {
+    int from = chess::string2index(expected[i].substr(0, 2));
+    int to = chess::string2index(expected[i].substr(2, 2));
+    EXPECT_EQ(moves[i], std::make_pair(std::min(from, to), std::max(from, to))) << expected[i];
+  }
+}
+
+TEST(VideoCaptureTest, OccupancyClassifier) {
+  cv::Mat before = cv::imread("../test/boards/move000.jpg", cv::IMREAD_GRAYSCALE);
+  cv::Mat after = cv::imread("../test/boards/move001-d2d4.jpg", cv::IMREAD_GRAYSCALE);
+  chess::Position position;
+  OccupancyClassifier occupancy;
+  ASSERT_TRUE(occupancy.train(before, position));
+  occupancy.classify(after);
+  std::vector<chess::Move> moves = position.generate_legal_moves();
+  std::vector<double> scores = occupancy.score(position, moves);
+  int best = std::max_element(scores.begin(), scores.end()) - scores.begin();
+  EXPECT_EQ(moves[best].to_string(), "d2d4");
+}
+
+TEST(VideoCaptureTest, ChangeVote) {
+  SquareChange changes[64];
+  for (int i = 0; i < 64; i++) {
+    changes[i] = {i % 8, i / 8, i, 0};
+  }
+  ChangeVote vote;
+  // A shadow makes square 5 look changed in one of three frames
+  for (int frame = 0; frame < 3; frame++) {
+    changes[10].change = 100;
+    changes[20].change = 90;
+    changes[5].change = frame == 0 ? 150 : 0;
+    vote.add(changes);
+  }
+  EXPECT_EQ(vote.frames(), 3);
+  SquareChange result[64];
+  EXPECT_NEAR(vote.result(result), 2.0 / 3, 1e-9);
+  EXPECT_EQ(result[0].index, 10);
+  EXPECT_EQ(result[1].index, 20);
+  EXPECT_EQ(result[0].change, 100);
+  vote.clear();
+  EXPECT_EQ(vote.frames(), 0);
+}
+
 TEST(VideoCaptureTest, Difference) {
   std::vector<std::string> file_names({
     "move000.jpg",
@@ -74,3 +424,276 @@ TEST(VideoCaptureTest, Difference) {
     hsv_planes_before[0] = hsv_planes_after[0];
   }
 }
+
+TEST(VideoCaptureTest, Calibration) {
+  cv::Mat reference = cv::imread("../test/boards/move000.jpg", cv::IMREAD_GRAYSCALE);
+  Board board;
+  board.perspective_transform = camera_transform();
+  board.gray = cv::Mat(480, 864, CV_8UC1, cv::Scalar(90));
+  cv::warpPerspective(reference, board.gray, board.perspective_transform.inv(), board.gray.size(),
+    cv::INTER_LINEAR, cv::BORDER_TRANSPARENT);
+  cv::warpPerspective(board.gray, board.reference, board.perspective_transform, {480, 480});
+  std::filesystem::remove_all("calibration-test");
+  EXPECT_EQ(load_calibration("calibration-test", board.gray.size()), nullptr);
+  ASSERT_TRUE(save_calibration("calibration-test", board));
+  EXPECT_EQ(load_calibration("calibration-test", {640, 360}), nullptr);
+
+  std::shared_ptr<Board> loaded = load_calibration("calibration-test", board.gray.size());
+  ASSERT_NE(loaded, nullptr);
+  EXPECT_GT(calibration_match(*loaded, board.gray), 0.99);
+  cv::Mat darker = board.gray * 0.6;
+  EXPECT_GT(calibration_match(*loaded, darker), 0.99);
+  cv::Mat moved;
+  cv::Mat shift = (cv::Mat_<double>(2, 3) << 1, 0, 30, 0, 1, 0);
+  cv::warpAffine(board.gray, moved, shift, board.gray.size(), cv::INTER_LINEAR, cv::BORDER_CONSTANT, 90);
+  EXPECT_LT(calibration_match(*loaded, moved), 0.5);
+}
+
+TEST(VideoCaptureTest, AnalysisSize) {
+  VideoCapture video_capture(
+    [&]() {
+    },
+    [&](FinishedMove& finished) {
+      return "";
+    }
+  );
+  cv::Mat board = cv::imread("../test/boards/move000.jpg", cv::IMREAD_GRAYSCALE);
+  cv::Mat transform = camera_transform();
+  cv::Mat frame(480, 864, CV_8UC1, cv::Scalar(90));
+  cv::warpPerspective(board, frame, transform.inv(), frame.size(), cv::INTER_LINEAR, cv::BORDER_TRANSPARENT);
+  video_capture.set_transform(transform);
+
+  cv::Mat full, half;
+  video_capture.set_analysis_size(480);
+  video_capture.warp(frame, full);
+  EXPECT_EQ(full.size(), cv::Size(480, 480));
+  video_capture.set_analysis_size(250);
+  video_capture.warp(frame, half);
+  ASSERT_EQ(half.size(), cv::Size(240, 240));
+  cv::Mat downsampled;
+  cv::resize(full, downsampled, half.size(), 0, 0, cv::INTER_AREA);
+  EXPECT_LT(cv::norm(half, downsampled, cv::NORM_L1) / half.total(), 3);
+}
+
+TEST(VideoCaptureTest, AnalysisSizeDuringGame) {
+  std::vector<cv::Mat> boards({
+    cv::imread("../test/boards/move000.jpg"),
+    cv::imread("../test/boards/move001-d2d4.jpg"),
+    cv::imread("../test/boards/move002-b7b5.jpg"),
+    cv::imread("../test/boards/move003-e2e4.jpg")
+  });
+  write_replay("analysis-size-test", boards);
+
+  std::vector<std::pair<int, int>> moves;
+  std::vector<cv::Size> sizes;
+  VideoCapture video_capture(
+    [&]() {
+    },
+    [&](FinishedMove& finished) {
+      moves.push_back(std::minmax(finished.changes[0].index, finished.changes[1].index));
+      EXPECT_EQ(finished.before.size(), finished.after.size());
+      sizes.push_back(finished.after.size());
+      if (moves.size() == 1) {
+        // Frame lock is not held during the callback
+        video_capture.set_analysis_size(480);
+      }
+      return "move";
+    }
+  );
+  video_capture.set_calibration_directory("analysis-size-test/calibration");
+  ReplaySource source("analysis-size-test/frames", ReplaySource::Pacing::Fast, 5);
+  video_capture.replay(source);
+  // Size changed right after the first move, the image the next moves are
+  // compared with was scaled too
+  ASSERT_EQ(moves.size(), 3);
+  EXPECT_EQ(sizes[0], cv::Size(240, 240));
+  EXPECT_EQ(sizes[1], cv::Size(480, 480));
+  EXPECT_EQ(sizes[2], cv::Size(480, 480));
+  std::vector<std::string> expected({"d2d4", "b7b5", "e2e4"});
+  for (int i = 0; i < expected.size(); i++) {
+    int from = chess::string2index(expected[i].substr(0, 2));
+    int to = chess::string2index(expected[i].substr(2, 2));
+    EXPECT_EQ(moves[i], std::make_pair(std::min(from, to), std::max(from, to))) << expected[i];
+  }
+}
+
+TEST(VideoCaptureTest, MatchLighting) {
+  cv::Mat before, after;
+  cv::resize(cv::imread("../test/boards/move000.jpg", cv::IMREAD_GRAYSCALE), before, {240, 240}, 0, 0, cv::INTER_AREA);
+  cv::resize(cv::imread("../test/boards/move001-d2d4.jpg", cv::IMREAD_GRAYSCALE), after, {240, 240}, 0, 0, cv::INTER_AREA);
+  // Clouds came
+  cv::Mat darker = after * 0.7;
+
+  cv::Mat matched;
+  match_lighting(after, darker, matched);
+  EXPECT_LT(cv::norm(matched, darker, cv::NORM_L1) / darker.total(), 2);
+
+  cv::Mat diff;
+  move_difference(before, darker, diff);
+  SquareChange changes[64];
+  square_changes(diff, 5, changes);
+  std::sort(changes, changes + 64, [](const SquareChange& a, const SquareChange& b) {
+    return a.change > b.change;
+  });
+  std::pair<int, int> top = std::minmax(changes[0].index, changes[1].index);
+  EXPECT_EQ(top, std::make_pair(chess::string2index("d2"), chess::string2index("d4")));
+}
+
+TEST(VideoCaptureTest, VisionEvents) {
+  VisionEvents events(4);
+  VisionEvents::Subscription early = events.subscribe();
+  VisionEvent event;
+  event.type = VisionEvent::Type::MotionStart;
+  events.publish(event);
+  VisionEvents::Subscription late = events.subscribe();
+  for (int i = 0; i < 5; i++) {
+    event.type = VisionEvent::Type::FrameDropped;
+    event.dropped = i;
+    events.publish(event);
+  }
+
+  std::optional<VisionEvent> next = late.next(std::chrono::milliseconds(0));
+  ASSERT_TRUE(next.has_value());
+  EXPECT_EQ(next->sequence, 2);
+  EXPECT_EQ(next->dropped, 1);
+  EXPECT_EQ(late.missed(), 1);
+  // Publisher doesn't wait for early subscriber, it misses the oldest events
+  next = early.next(std::chrono::milliseconds(0));
+  ASSERT_TRUE(next.has_value());
+  EXPECT_EQ(next->sequence, 2);
+  EXPECT_EQ(early.missed(), 2);
+  for (int i = 0; i < 3; i++) {
+    EXPECT_TRUE(early.next(std::chrono::milliseconds(0)).has_value());
+  }
+  EXPECT_FALSE(early.next(std::chrono::milliseconds(10)).has_value());
+
+  std::thread publisher([&]() {
+    event.type = VisionEvent::Type::BoardLost;
+    events.publish(event);
+    events.close();
+  });
+  next = early.next(std::chrono::seconds(10));
+  ASSERT_TRUE(next.has_value());
+  EXPECT_EQ(next->type, VisionEvent::Type::BoardLost);
+  EXPECT_FALSE(early.next(std::chrono::seconds(10)).has_value());
+  publisher.join();
+}
+
+TEST(VideoCaptureTest, Castling) {
+  cv::Mat before = cv::imread("../test/boards/move000.jpg");
+  // White pieces are on the right, files go from h at the top to a at the
+  // bottom. Pieces lean to the left, so a bit of rank 2 changes too.
+  cv::Mat after = before.clone();
+  auto rank1 = [](int file) { return cv::Rect(400, (7 - file) * 60, 80, 60); };
+  auto rank3 = [](int file) { return cv::Rect(220, (7 - file) * 60, 80, 60); };
+  before(rank1(4)).copyTo(after(rank1(6)));
+  before(rank1(7)).copyTo(after(rank1(5)));
+  before(rank3(4)).copyTo(after(rank1(4)));
+  before(rank3(7)).copyTo(after(rank1(7)));
+  write_replay("castling-test", {before, after});
+
+  int started = 0;
+  std::vector<std::set<int>> moves;
+  VideoCapture video_capture(
+    [&]() {
+      started++;
+    },
+    [&](FinishedMove& finished) {
+      std::set<int> squares;
+      for (int i = 0; i < 4; i++) {
+        squares.insert(finished.changes[i].index);
+      }
+      moves.push_back(squares);
+      return "e1g1";
+    }
+  );
+  video_capture.set_calibration_directory("castling-test/calibration");
+  ReplaySource source("castling-test/frames", ReplaySource::Pacing::Fast, 5);
+  video_capture.replay(source);
+  // King and rook change more than motion detector needs to start, that
+  // must not restart the move once it is finished
+  EXPECT_EQ(started, 1);
+  ASSERT_EQ(moves.size(), 1);
+  std::set<int> castling({chess::string2index("e1"), chess::string2index("f1"),
+    chess::string2index("g1"), chess::string2index("h1")});
+  EXPECT_EQ(moves[0], castling);
+}
+
+TEST(VideoCaptureTest, ReplayEvents) {
+  write_replay("events-test", {
+    cv::imread("../test/boards/move000.jpg"),
+    cv::imread("../test/boards/move001-d2d4.jpg")
+  });
+  VideoCapture video_capture(
+    [&]() {
+    },
+    [&](FinishedMove& finished) {
+      return "d2d4";
+    }
+  );
+  video_capture.set_calibration_directory("events-test/calibration");
+  VisionEvents::Subscription subscription = video_capture.events().subscribe();
+  // Stream stays open when replay ends, the next game is published too
+  for (int game = 0; game < 2; game++) {
+    ReplaySource source("events-test/frames", ReplaySource::Pacing::Fast, 5);
+    video_capture.replay(source);
+
+    std::vector<VisionEvent> events;
+    while (std::optional<VisionEvent> event = subscription.next(std::chrono::milliseconds(0))) {
+      events.push_back(event.value());
+    }
+    ASSERT_EQ(events.size(), 5);
+    EXPECT_EQ(events[0].type, VisionEvent::Type::MotionStart);
+    EXPECT_EQ(events[1].type, VisionEvent::Type::MotionEnd);
+    // Squares are scored from the frame motion ended in until the move is
+    // confirmed
+    EXPECT_EQ(events[2].frame_sequence, events[1].frame_sequence);
+    for (int i = 2; i < events.size(); i++) {
+      EXPECT_EQ(events[i].type, VisionEvent::Type::SquareScores);
+      EXPECT_EQ(events[i].frame_sequence, events[1].frame_sequence + i - 2);
+    }
+    const std::array<double, 64>& scores = events.back().scores;
+    std::vector<int> squares(64);
+    std::iota(squares.begin(), squares.end(), 0);
+    std::partial_sort(squares.begin(), squares.begin() + 2, squares.end(), [&](int a, int b) {
+      return scores[a] > scores[b];
+    });
+    std::pair<int, int> top = std::minmax(squares[0], squares[1]);
+    EXPECT_EQ(top, std::make_pair(chess::string2index("d2"), chess::string2index("d4")));
+  }
+  EXPECT_EQ(subscription.missed(), 0);
+}
+
+TEST(VideoCaptureTest, StartFromHalfResolution) {
+  write_replay("half-resolution-test", {
+    cv::imread("../test/boards/move000.jpg"),
+    cv::imread("../test/boards/move001-d2d4.jpg")
+  });
+  // Camera is still at the reduced resolution of an idle game
+  for (std::string file : {"frame0000.jpg", "frame0001.jpg"}) {
+    std::string path = "half-resolution-test/frames/" + file;
+    cv::Mat half;
+    cv::resize(cv::imread(path), half, {}, 0.5, 0.5, cv::INTER_AREA);
+    cv::imwrite(path, half);
+  }
+
+  bool board_not_found = false;
+  std::vector<std::pair<int, int>> moves;
+  VideoCapture video_capture(
+    [&]() {
+    },
+    [&](FinishedMove& finished) {
+      moves.push_back(std::minmax(finished.changes[0].index, finished.changes[1].index));
+      return "d2d4";
+    },
+    [&]() {
+      board_not_found = true;
+    }
+  );
+  video_capture.set_calibration_directory("half-resolution-test/calibration");
+  ReplaySource source("half-resolution-test/frames", ReplaySource::Pacing::Fast, 5);
+  video_capture.replay(source);
+  EXPECT_FALSE(board_not_found);
+  ASSERT_EQ(moves.size(), 1);
+  EXPECT_EQ(moves[0], std::make_pair(chess::string2index("d2"), chess::string2index("d4")));
+}